@@ -15,12 +15,23 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <regex.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -33,8 +44,56 @@
 #define EDITOR_QUIT_TIMES 3
 #define STATUS_DURATION 8
 #define EDITOR_TAB_STOP 8
+#define EDITOR_MAX_WINDOWS 8
+#define EDITOR_MAX_THREADS 16
+#define EDITOR_ROWS_PER_THREAD 16384 // Fewer rows than this per thread aren't worth a thread
+#define EDITOR_RENDER_IDLE 30 // Seconds before an unviewed buffer drops its render caches
+#define EDITOR_VIEW_THRESHOLD (256LL << 20) // Files bigger than this are opened in view mode
+#define EDITOR_VIEW_STRIDE 4096 // Lines between two entries of the sparse line index
+#define EDITOR_VIEW_WINDOW 256 // Rows kept in memory around the viewport in view mode
+#define EDITOR_VIEW_MAX_LINE 8192 // Bytes of a line shown in view mode, the rest is cut
+#define EDITOR_VIEW_CHUNK (1 << 20) // Bytes read at once while scanning a file in view mode
+#define EDITOR_INDEX_CACHE 1 // Set to 0 to never read or write line index sidecars
+#define EDITOR_INDEX_MIN (64LL << 20) // Files smaller than this are scanned again instead of getting a sidecar
+#define EDITOR_INDEX_SAMPLES 16 // Blocks of the file hashed to check that a sidecar still matches it
+#define EDITOR_COLD_BUDGET (512LL << 20) // Default bytes of unpacked rows before cold ones are packed, see -m
+#define EDITOR_COLD_ROWS 4096 // Rows packed together in one block
+#define EDITOR_COLD_IDLE 10 // Seconds an unpacked block is left alone before it may be packed again
+#define EDITOR_COLD_INTERVAL 2 // Seconds between two packing passes
+#define EDITOR_COLD_RECENT 16 // Unpacked blocks remembered for EDITOR_COLD_IDLE
+#define EDITOR_DIFF_GUTTER 2 // Columns of the diff marks left of the text
+#define EDITOR_DIFF_MAX_COST 4096 // Edits tried before a gap is marked changed as a whole
+#define EDITOR_COMPLETE_MAX 32 // Completions offered for one prefix
+#define EDITOR_COMPLETE_MIN_WORD 3 // Shorter identifiers aren't worth completing
+#define EDITOR_COMPLETE_MAX_WORD 64 // Longer ones aren't indexed
+#define EDITOR_COMPLETE_SLICE 20 // Milliseconds of indexing done each time keys are awaited
+#define EDITOR_JOURNAL_SYNC 1 // Seconds between two syncs of the journals
+#define EDITOR_JOURNAL_MAX_PENDING (1 << 20) // Bytes of records queued before they are written
+#define EDITOR_FILTER_SLICE 500 // Milliseconds spent feeding a filter each time keys are awaited, unless one comes
+#define EDITOR_FILTER_IOV 512 // Rows handed to one writev()
+#define EDITOR_FILTER_PIPE (1 << 20) // Bytes asked for the pipes of a filter, fewer wakeups for big ranges
 #define CTRL_KEY(k) ((k) & 0x1f)
 
+enum EditorSelection {
+	SELECT_NONE,
+	SELECT_CHARS,
+	SELECT_LINES
+};
+
+enum DiffMark {
+	DIFF_SAME = ' ',
+	DIFF_ADDED = '+',
+	DIFF_CHANGED = '~',
+	DIFF_REMOVED = '-' // Lines removed right above the row
+};
+
+enum JournalRecordType {
+	JOURNAL_SPLICE = 1, // Row a: c bytes at b replaced by the payload
+	JOURNAL_INSERT_ROWS, // b rows inserted at a, the payload holds them newline terminated
+	JOURNAL_DELETE_ROWS, // b rows deleted at a
+	JOURNAL_REPLACE_ALL // editor_replace_all(), a tells if it was a pattern, b is the length of find in the payload
+};
+
 enum EditorKey {
 	BACKSPACE = 127,
 	ARROW_LEFT = 1000,
@@ -56,13 +115,161 @@ struct EditorRow {
 
 	int rsize;
 	char* render;
+
+	int* cols; // Column of each byte of chars, only for rows with non-ASCII bytes, NULL otherwise
+
+	uint64_t hash; // Hash of chars for the diff gutter, 0 until editor_row_hash() computes it
+
+	// Size, words and UTF-8 characters of chars as last added to the totals of struct RowStats
+	int countedSize;
+	int countedWords;
+	int countedChars;
+
+	int indexed; // 1 when its identifiers are in the completion index, -1 for rows never indexed
 };
 
-struct EditorConfig {
-	struct termios origTermios; // Struct 'termios' named origTermios which contains fields defined in termios.h
+// Sparse line index of a file opened in view mode, see editor_open_view()
+struct ViewIndex {
+	int fd;
+	off_t size;
 
-	int screenRows; // Number of terminal rows
-	int screenCols; // Number of terminal collumns
+	off_t* offsets; // offsets[k] is the byte offset of line k * EDITOR_VIEW_STRIDE
+	long long numOffsets;
+	long long capOffsets;
+	void* map; // Sidecar index that offsets points into when it was loaded from disk, see editor_index_load()
+	size_t mapLen;
+
+	long long lines; // Number of newline terminated lines, may be more than the rows of the buffer, see editor_view_rows()
+	int partial; // Set when the file doesn't end with a newline, its last line is a row too
+
+	long long first; // First line held in rows
+	int count; // Number of lines held in rows
+	off_t end; // Byte offset right after line first + count - 1
+	struct EditorRow rows[EDITOR_VIEW_WINDOW];
+
+	char* chunk; // Last block read from the file
+	off_t chunkOff;
+	ssize_t chunkLen;
+};
+
+// State of a buffer following the growth of its file, see editor_follow_toggle()
+struct FollowState {
+	int fd;
+	int wd; // inotify watch descriptor
+	off_t off; // Bytes of the file already in the buffer
+	int partial; // Set when the last row hasn't seen its newline yet
+};
+
+// Journal of the unsaved changes of a buffer, see editor_journal_record()
+struct Journal {
+	int fd;
+	char* path;
+
+	char* pending; // Records not written yet
+	size_t len;
+	size_t cap;
+	long lastRecord; // Offset of the last record in pending, -1 if it was written already
+
+	int unsynced;
+	time_t lastSync;
+};
+
+// Rows first to first + count - 1 of a row array, their chars compressed back to back, see editor_cold_pack()
+struct ColdBlock {
+	int first;
+	int count;
+	int rawLen;
+	int packedLen;
+	char* packed;
+};
+
+/* Reads rows in order without unpacking their blocks for good, for the passes over a whole buffer
+ * A packed block is decompressed into raw instead, only one of them is held at a time, see editor_cold_peek()
+ */
+struct ColdReader {
+	struct EditorBuffer* buf;
+	int first; // Rows first to first + count - 1 are decompressed in raw
+	int count;
+	char* raw;
+	int rawCap;
+	int next; // Row of the block whose chars start at raw + off
+	int off;
+};
+
+// Totals of a row array for the status bar, kept up to date by the row operations, see editor_stats_sync()
+struct RowStats {
+	long long bytes; // Every row counts its newline
+	long long words;
+	long long chars;
+
+	long long* tree; // Fenwick tree of the bytes of each row, gives the byte offset of a row
+	int treeCap;
+	int treeValid; // Nodes 1 to treeValid are up to date, the others are rebuilt when asked
+
+	int dirty; // Set when the chars of rows from dirtyLo to dirtyHi - 1 changed since they were counted
+	int dirtyLo;
+	int dirtyHi;
+};
+
+// Bookkeeping for a row array shared by several buffers opened on the same file
+struct RowShare {
+	int refs; // Number of buffers pointing at the row array
+	time_t lastViewed; // Last time any of those buffers was drawn
+	int rendersDropped; // Set once the render caches were freed for being idle
+
+	struct ColdBlock* cold; // Packed ranges of rows, sorted by first
+	int numCold;
+	int recent[EDITOR_COLD_RECENT]; // First rows of the last blocks unpacked
+	int numRecent;
+	time_t recentTime; // When the last of them was unpacked
+
+	struct RowStats stats;
+	int indexFrom; // Rows below are all in the completion index, see editor_complete_tick()
+};
+
+// Differences between a buffer and its file on disk, see editor_diff_update()
+struct DiffState {
+	uint64_t* disk; // Hashes of the lines of the file
+	int diskRows;
+	int* match; // Disk line each row is matched with, -1 if none
+	char* mark; // enum DiffMark of each row, and of the end of the buffer
+	int cap;
+	int dirty; // Set when rows from dirtyLo to dirtyHi - 1, or lines removed at dirtyLo, need to be diffed again
+	int dirtyLo;
+	int dirtyHi;
+};
+
+// External command the rows of a buffer are sent through, its output replaces them, see editor_filter_tick()
+struct FilterJob {
+	pid_t pid;
+	int in; // Pipe to the stdin of the command, -1 once every row is sent
+	int out; // Pipe from its stdout, -1 once it is closed
+	char* command;
+	struct timespec start;
+
+	int from; // Rows from to to - 1 are replaced
+	int to;
+	int next; // Next row to send
+	int sent; // Bytes of row next already sent, its newline is the byte past its chars
+	struct ColdReader reader; // Packed rows are sent from there
+
+	struct EditorRow* rows; // Lines of output read so far
+	int numRows;
+	int capRows;
+	char* partial; // Output following the last newline
+	size_t partialLen;
+	size_t partialCap;
+};
+
+// A cursor in addition to the one of a buffer, see CURSORS
+struct EditorCursor {
+	int x;
+	int y;
+};
+
+// One open file (or scratch buffer) with its own cursor and scroll state
+struct EditorBuffer {
+	int id; // Index in ec.bufs
 
 	int curx; // Cursor x position
 	int cury; // Cursor y position
@@ -72,12 +279,74 @@ struct EditorConfig {
 	int rowOffset;
 	int colOffset;
 
+	enum EditorSelection select;
+	int selx; // Selection anchor, the cursor is its other end
+	int sely;
+
 	int numRows;
 	struct EditorRow* row;
+	struct RowShare* share; // Copy-on-write state of row, see editor_buffer_unshare()
+	struct ViewIndex* view; // Set when the buffer is a read-only view of a huge file, row is unused then
+	struct FollowState* follow; // Set while new bytes of the file are appended as they are written
+	struct Journal* journal; // Created on the first change
+	int noJournal; // Set when the journal can't be created
+	int unjournaled; // Set when changes were made while another buffer of the file held the journal, until saved
+	struct DiffState* diff; // Set while the differences with the file are shown
+	struct FilterJob* filter; // Set while rows are sent through an external command, edits wait for it
+
+	struct EditorCursor* cursors; // Extra cursors sorted by row then column, never at curx / cury
+	int numCursors;
+	int capCursors;
 
 	int modified;
 
 	char* filename;
+	int compressed; // Read from a gzip file, saved compressed too
+	dev_t dev; // Identity of the file on disk, used to share rows between buffers
+	ino_t ino;
+	time_t mtime;
+	off_t size; // Bytes read from the file when it was opened
+};
+
+// A horizontal split of the terminal showing one buffer
+struct EditorWindow {
+	struct EditorBuffer* buf;
+
+	int top; // First terminal row of the window
+	int rows; // Number of text rows, not counting the window's status bar
+};
+
+struct EditorConfig {
+	struct termios origTermios; // Struct 'termios' named origTermios which contains fields defined in termios.h
+
+	int screenCols; // Number of terminal collumns
+	int textRows; // Number of terminal rows shared by all windows (excludes the message bar)
+
+	int numBufs;
+	struct EditorBuffer** bufs; // Every open buffer, in opening order
+
+	int numWins;
+	int curWin;
+	struct EditorWindow win[EDITOR_MAX_WINDOWS];
+
+	struct EditorBuffer* buf; // Buffer of the active window, always win[curWin].buf
+
+	int inotifyFd; // Shared by every buffer in follow mode, -1 until the first one starts
+
+	int interactive; // Set once the terminal is in raw mode, the user can be asked questions
+	int journalPaused; // Changes aren't journaled while loading, following or replaying
+	int completePaused; // Rows aren't indexed for completion by editor_update_row() while loading or replacing
+
+	int* macro; // Keys recorded by editor_read_key() between two Ctrl-k
+	int macroLen;
+	int macroCap;
+	int recording;
+	int replaying; // Keys come from macro then and the screen isn't drawn
+	int macroPos; // Next key of macro to replay
+
+	size_t coldBudget; // Bytes of unpacked rows kept before cold rows are packed
+	long coldUnpacks;
+	double coldUnpackMs; // Time spent in all coldUnpacks
 
 	char statusmsg[80];
 	time_t statusmsg_time;
@@ -88,6 +357,52 @@ struct EditorConfig {
 void editor_set_status_message(const char* fmt, ...);
 void editor_refresh_screen(void);
 char* editor_prompt(char* prompt, void (*callback)(char*, int));
+char* editor_prompt_input(char* prompt, void (*callback)(char*, int), int allowEmpty);
+char* editor_row_render(struct EditorRow* row);
+int editor_row_next_char(struct EditorRow* row, int at);
+void editor_buffer_unshare(struct EditorBuffer* buf);
+void editor_view_release(struct ViewIndex* v);
+int editor_open_view(char* filename);
+int editor_index_load(struct ViewIndex* v, const char* filename, struct stat* st);
+void editor_index_store(struct ViewIndex* v, const char* filename, struct stat* st);
+int editor_follow_poll(void);
+struct EditorRow* editor_buffer_row(struct EditorBuffer* buf, int at);
+int editor_journal_record(struct EditorBuffer* buf, int type, int a, int b, int c, const char* s, size_t len);
+void editor_journal_splice(struct EditorRow* row, int at, int del, const char* s, size_t len);
+void editor_journal_insert_rows(struct EditorBuffer* buf, int at, struct EditorRow* rows, int n);
+int editor_journal_write(struct EditorBuffer* buf);
+void editor_journal_close(struct EditorBuffer* buf, int unlinkFile);
+void editor_journal_recover(struct EditorBuffer* buf);
+void editor_journal_sync(void);
+void editor_journal_reset(struct EditorBuffer* buf);
+void editor_row_init(struct EditorRow* row, char* s, size_t len);
+void editor_replace_all(char* find, char* with, int isRegex);
+long editor_replace_buffer(struct EditorBuffer* buf, char* find, char* with, int isRegex, int* changedRows, int* threads);
+void editor_cold_thaw(struct EditorBuffer* buf, int from, int to);
+void editor_cold_move(struct EditorBuffer* buf, int at, int delta);
+int editor_cold_tick(void);
+uint64_t editor_hash_bytes(const char* s, size_t len);
+void editor_diff_touch(struct EditorBuffer* buf, int at);
+void editor_diff_move(struct EditorBuffer* buf, int at, int delta);
+void editor_diff_touch_changed(struct EditorBuffer* buf);
+void editor_diff_saved(struct EditorBuffer* buf);
+int editor_diff_tick(void);
+void editor_stats_touch(struct EditorBuffer* buf, int at, int to);
+void editor_stats_insert(struct EditorBuffer* buf, int at, int n);
+void editor_stats_remove(struct EditorBuffer* buf, int at, int n);
+void editor_stats_sync(struct EditorBuffer* buf);
+void editor_complete_learn(struct EditorRow* row);
+void editor_complete_forget(struct EditorRow* row);
+void editor_complete_relearn(struct EditorRow* row, const char* old, int oldSize);
+void editor_complete_insert(struct EditorBuffer* buf, int at, int n);
+void editor_complete_remove(struct EditorBuffer* buf, int at, int n);
+void editor_complete_tick(void);
+int editor_open(char* filename);
+void editor_move_cursor(int key);
+void editor_process_keypress(void);
+int editor_type_string(char* s, int len);
+int editor_filter_tick(void);
+double editor_bench_ms(struct timespec* start);
 
 /***** TERMINAL *****/
 
@@ -164,12 +479,14 @@ void enable_raw_mode(void) {
 	 */
 	if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
 		die("enable_raw_mode()::tcsetattr()");
+
+	ec.interactive = 1;
 }
 
 /* Reads the input and catch errors
- * editor_read_key() is called by editor_process_keypress()
+ * editor_read_terminal_key() is called by editor_read_key()
  */
-int editor_read_key(void) {
+int editor_read_terminal_key(void) {
 	int nRead;
 	char c;
 
@@ -178,6 +495,23 @@ int editor_read_key(void) {
 	while ((nRead = read(STDIN_FILENO, &c, 1)) != 1) {
 		if (nRead == -1 && errno != EAGAIN)
 			die("editor_read_key()::read()");
+
+		// read() times out every VTIME, followed files are checked then, so redraws are coalesced
+		if (editor_follow_poll())
+			editor_refresh_screen();
+
+		editor_journal_sync();
+
+		if (editor_cold_tick())
+			editor_refresh_screen();
+
+		if (editor_diff_tick())
+			editor_refresh_screen();
+
+		editor_complete_tick();
+
+		if (editor_filter_tick())
+			editor_refresh_screen();
 	}
 
 	if (c == '\x1b') {
@@ -234,8 +568,34 @@ int editor_read_key(void) {
 
 		return '\x1b';
 	} else {
-		return c;
+		return (unsigned char) c;
+	}
+}
+
+/* Returns the next key, editor_read_key() is called by editor_process_keypress() and the prompts
+ * A macro being replayed stands in for the terminal, Esc gets out of a prompt it leaves open
+ */
+int editor_read_key(void) {
+	if (ec.replaying) {
+		return ec.macroPos < ec.macroLen ? ec.macro[ec.macroPos++] : '\x1b';
+	}
+
+	int c = editor_read_terminal_key();
+
+	// The keys that stop recording and replay aren't part of the macro
+	if (ec.recording && c != CTRL_KEY('k') && c != CTRL_KEY('e')) {
+		if (ec.macroLen == ec.macroCap) {
+			ec.macroCap = ec.macroCap ? ec.macroCap * 2 : 64;
+			ec.macro = realloc(ec.macro, sizeof(int) * ec.macroCap);
+			if (ec.macro == NULL) {
+				die("editor_read_key()::realloc()");
+			}
+		}
+
+		ec.macro[ec.macroLen++] = c;
 	}
+
+	return c;
 }
 
 // Gets the cursor position in the terminal
@@ -282,9 +642,224 @@ int get_window_size(int* rows, int* cols) {
 	}
 }
 
+/***** UTF-8 *****/
+
+// Ranges of code points taking no column (combining marks and the like), sorted
+static const int zeroWidth[][2] = {
+	{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+	{0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+	{0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+	{0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0900, 0x0902}, {0x093A, 0x093A},
+	{0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+	{0x0962, 0x0963}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+	{0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E},
+	{0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+	{0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF}
+};
+
+// Ranges of East Asian Wide and Fullwidth code points taking two columns, sorted
+static const int doubleWidth[][2] = {
+	{0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+	{0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+	{0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+	{0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+	{0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+	{0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+	{0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+	{0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+	{0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+	{0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+	{0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+	{0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x1F300, 0x1F64F},
+	{0x1F900, 0x1F9FF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+};
+
+int utf8_in_table(int cp, const int table[][2], int n) {
+	int lo = 0;
+	int hi = n - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+
+		if (cp < table[mid][0]) {
+			hi = mid - 1;
+		} else if (cp > table[mid][1]) {
+			lo = mid + 1;
+		} else {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Number of terminal columns taken by code point cp
+int utf8_width(int cp) {
+	if (cp < 0x300) {
+		return 1;
+	}
+
+	if (utf8_in_table(cp, zeroWidth, sizeof zeroWidth / sizeof zeroWidth[0])) {
+		return 0;
+	}
+
+	if (utf8_in_table(cp, doubleWidth, sizeof doubleWidth / sizeof doubleWidth[0])) {
+		return 2;
+	}
+
+	return 1;
+}
+
+/* Decodes the code point at the start of the len bytes of s into *cp
+ * Returns the length of its sequence, or 1 with *cp set to -1 for an invalid byte
+ */
+int utf8_decode(const char* s, int len, int* cp) {
+	const unsigned char* u = (const unsigned char*) s;
+
+	*cp = -1;
+	if (len <= 0) {
+		return 1;
+	}
+
+	if (u[0] < 0x80) {
+		*cp = u[0];
+		return 1;
+	}
+
+	int n;
+	int c;
+	int min;
+	if ((u[0] & 0xE0) == 0xC0) {
+		n = 2;
+		c = u[0] & 0x1F;
+		min = 0x80;
+	} else if ((u[0] & 0xF0) == 0xE0) {
+		n = 3;
+		c = u[0] & 0x0F;
+		min = 0x800;
+	} else if ((u[0] & 0xF8) == 0xF0) {
+		n = 4;
+		c = u[0] & 0x07;
+		min = 0x10000;
+	} else {
+		return 1;
+	}
+
+	if (n > len) {
+		return 1;
+	}
+
+	for (int j = 1; j < n; j++) {
+		if ((u[j] & 0xC0) != 0x80) {
+			return 1;
+		}
+		c = (c << 6) | (u[j] & 0x3F);
+	}
+
+	// Overlong forms, surrogates and values past Unicode are rejected
+	if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+		return 1;
+	}
+
+	*cp = c;
+	return n;
+}
+
+/* Returns 1 if no byte of s has its high bit set
+ * Bytes are OR'd together 8 at a time so the check is a few instructions per word
+ */
+int utf8_is_ascii(const char* s, int len) {
+	uint64_t acc = 0;
+	int j = 0;
+
+	for (; j + 8 <= len; j += 8) {
+		uint64_t word;
+		memcpy(&word, &s[j], 8);
+		acc |= word;
+	}
+
+	for (; j < len; j++) {
+		acc |= (unsigned char) s[j];
+	}
+
+	return (acc & 0x8080808080808080ULL) == 0;
+}
+
+// Returns 1 for the bytes isspace() accepts in the C locale
+int utf8_is_space(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Returns a word with the high bit of each byte of v that is a space for utf8_is_space() set
+ * Setting the high bit first keeps the subtractions from borrowing across bytes
+ */
+uint64_t utf8_space_mask(uint64_t v) {
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t high = 0x8080808080808080ULL;
+
+	uint64_t x = v ^ (ones * ' ');
+	uint64_t isBlank = ~(((x & ~high) + ~high) | x) & high;
+
+	uint64_t y = v | high;
+	uint64_t isControl = (y - ones * '\t') & ~(y - ones * ('\r' + 1)) & ~v & high;
+
+	return isBlank | isControl;
+}
+
+/* Counts the UTF-8 characters and the words of the len bytes of s like wc -m and wc -w, the words go to words
+ * 8 bytes are looked at together, each compared with the byte before it to find where words start.
+ * The last bytes are copied into a zeroed word so short rows take no byte by byte loop
+ */
+int utf8_count(const char* s, int len, int* words) {
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t high = 0x8080808080808080ULL;
+
+	*words = 0;
+	if (len == 0) {
+		return 0;
+	}
+
+	int chars = ((unsigned char) s[0] & 0xC0) != 0x80;
+	int w = !utf8_is_space(s[0]);
+
+	for (int j = 1; j < len; j += 8) {
+		uint64_t cur = 0;
+		uint64_t prev = 0;
+		uint64_t valid = ~0ULL;
+
+		if (len - j >= 8) {
+			memcpy(&cur, &s[j], 8);
+			memcpy(&prev, &s[j - 1], 8);
+		} else {
+			memcpy(&cur, &s[j], len - j);
+			memcpy(&prev, &s[j - 1], len - j);
+			valid = 0;
+			memset(&valid, 0xFF, len - j);
+		}
+
+		// Continuation bytes are 10xxxxxx, a word starts with a non-space after a space
+		uint64_t lead = ~(cur & ~(cur << 1)) & valid & high;
+		uint64_t starts = ~utf8_space_mask(cur) & utf8_space_mask(prev) & valid & high;
+
+		// Adds up the high bits, the top byte of the product is the sum of all bytes
+		chars += (int) (((lead >> 7) * ones) >> 56);
+		w += (int) (((starts >> 7) * ones) >> 56);
+	}
+
+	*words = w;
+	return chars;
+}
+
 /***** ROW OPERATIONS *****/
 
 int editor_row_curx_to_rx(struct EditorRow* row, int curx) {
+	editor_row_render(row);
+
+	// Widths of rows with non-ASCII bytes are cached by editor_update_row()
+	if (row->cols) {
+		return row->cols[curx];
+	}
+
 	int rx = 0;
 	for (int j = 0; j < curx; j++) {
 		if (row->chars[j] == '\t') {
@@ -298,6 +873,21 @@ int editor_row_curx_to_rx(struct EditorRow* row, int curx) {
 }
 
 int editor_row_rx_to_curx(struct EditorRow* row, int rx) {
+	editor_row_render(row);
+
+	if (row->cols) {
+		int curx = 0;
+		while (curx < row->size) {
+			int next = editor_row_next_char(row, curx);
+			if (row->cols[next] > rx) {
+				return curx;
+			}
+			curx = next;
+		}
+
+		return curx;
+	}
+
 	int curRx = 0;
 	int curx;
 	for (curx = 0; curx < row->size; curx++) {
@@ -314,6 +904,81 @@ int editor_row_rx_to_curx(struct EditorRow* row, int rx) {
 	return curx;
 }
 
+// Returns the index of the character following the one at index at
+int editor_row_next_char(struct EditorRow* row, int at) {
+	int cp;
+	return at + utf8_decode(&row->chars[at], row->size - at, &cp);
+}
+
+// Returns the index of the character preceding the one at index at
+int editor_row_prev_char(struct EditorRow* row, int at) {
+	int start = at - 1;
+	while (start > 0 && at - start < 4 && ((unsigned char) row->chars[start] & 0xC0) == 0x80) {
+		start--;
+	}
+
+	// Continuation bytes not led by a valid sequence are characters of their own
+	if (editor_row_next_char(row, start) != at) {
+		return at - 1;
+	}
+
+	return start;
+}
+
+// Returns the index of the first byte of the character holding index at
+int editor_row_char_start(struct EditorRow* row, int at) {
+	int start = at;
+	while (start > 0 && at - start < 3 && ((unsigned char) row->chars[start] & 0xC0) == 0x80) {
+		start--;
+	}
+
+	return editor_row_next_char(row, start) > at ? start : at;
+}
+
+/* Builds the render of a row holding non-ASCII bytes
+ * Invalid bytes are shown as U+FFFD, and the column of every byte of chars is cached in cols
+ */
+void editor_update_row_utf8(struct EditorRow* row, int tabs) {
+	row->render = malloc(row->size * 3 + tabs * (EDITOR_TAB_STOP - 1) + 1);
+	row->cols = malloc(sizeof(int) * (row->size + 1));
+
+	int idx = 0;
+	int col = 0;
+	int j = 0;
+	while (j < row->size) {
+		int cp;
+		int n = utf8_decode(&row->chars[j], row->size - j, &cp);
+
+		for (int k = 0; k < n; k++) {
+			row->cols[j + k] = col;
+		}
+
+		if (cp == '\t') {
+			row->render[idx++] = ' ';
+			col++;
+
+			while (col % EDITOR_TAB_STOP) {
+				row->render[idx++] = ' ';
+				col++;
+			}
+		} else if (cp == -1) {
+			memcpy(&row->render[idx], "\xEF\xBF\xBD", 3);
+			idx += 3;
+			col++;
+		} else {
+			memcpy(&row->render[idx], &row->chars[j], n);
+			idx += n;
+			col += utf8_width(cp);
+		}
+
+		j += n;
+	}
+
+	row->cols[row->size] = col;
+	row->render[idx] = '\0';
+	row->rsize = idx;
+}
+
 void editor_update_row(struct EditorRow* row) {
 	int tabs = 0;
 	for (int j = 0; j < row->size; j++) {
@@ -323,6 +988,20 @@ void editor_update_row(struct EditorRow* row) {
 	}
 
 	free(row->render);
+	free(row->cols);
+	row->cols = NULL;
+	row->hash = 0; // The chars may have changed, editor_row_hash() computes it again when asked
+
+	if (row->indexed == 0 && !ec.completePaused) {
+		editor_complete_learn(row);
+	}
+
+	// Rows of plain ASCII skip decoding, one byte is one column
+	if (!utf8_is_ascii(row->chars, row->size)) {
+		editor_update_row_utf8(row, tabs);
+		return;
+	}
+
 	row->render = malloc(row->size + tabs * (EDITOR_TAB_STOP - 1) + 1);
 
 	int idx = 0;
@@ -345,42 +1024,143 @@ void editor_update_row(struct EditorRow* row) {
 	row->rsize = idx;
 }
 
+// Returns the render of row, rebuilding it if it was dropped by editor_drop_idle_renders()
+char* editor_row_render(struct EditorRow* row) {
+	if (row->render == NULL) {
+		editor_update_row(row);
+	}
+
+	return row->render;
+}
+
 void editor_insert_row(int at, char* s, size_t len) {
-	if (at < 0 || at > ec.numRows) {
+	if (at < 0 || at > ec.buf->numRows) {
+		return;
+	}
+
+	editor_buffer_unshare(ec.buf);
+	editor_cold_move(ec.buf, at, 1);
+	editor_diff_move(ec.buf, at, 1);
+
+	ec.buf->row = realloc(ec.buf->row, sizeof(struct EditorRow) * (ec.buf->numRows + 1));
+	memmove(&ec.buf->row[at + 1], &ec.buf->row[at], sizeof(struct EditorRow) * (ec.buf->numRows - at));
+
+	ec.buf->row[at].size = len;
+	ec.buf->row[at].chars = malloc(len + 1);
+	memcpy(ec.buf->row[at].chars, s, len);
+	ec.buf->row[at].chars[len] = '\0';
+
+	ec.buf->row[at].rsize = 0;
+	ec.buf->row[at].render = NULL;
+	ec.buf->row[at].cols = NULL;
+	ec.buf->row[at].indexed = 0;
+
+	editor_update_row(&ec.buf->row[at]);
+
+	ec.buf->numRows++;
+	ec.buf->modified++;
+	editor_stats_insert(ec.buf, at, 1);
+	editor_complete_insert(ec.buf, at, 1);
+
+	editor_journal_insert_rows(ec.buf, at, &ec.buf->row[at], 1);
+}
+
+/* Splices n rows whose chars are already allocated into buf at index at
+ * The row array is reallocated and moved once, renders are built lazily by editor_row_render()
+ */
+void editor_insert_rows(struct EditorBuffer* buf, int at, struct EditorRow* rows, int n) {
+	if (at < 0 || at > buf->numRows || n <= 0) {
 		return;
 	}
 
-	ec.row = realloc(ec.row, sizeof(struct EditorRow) * (ec.numRows + 1));
-	memmove(&ec.row[at + 1], &ec.row[at], sizeof(struct EditorRow) * (ec.numRows - at));
+	editor_buffer_unshare(buf);
+	editor_cold_move(buf, at, n);
+	editor_diff_move(buf, at, n);
 
-	ec.row[at].size = len;
-	ec.row[at].chars = malloc(len + 1);
-	memcpy(ec.row[at].chars, s, len);
-	ec.row[at].chars[len] = '\0';
+	buf->row = realloc(buf->row, sizeof(struct EditorRow) * (buf->numRows + n));
+	memmove(&buf->row[at + n], &buf->row[at], sizeof(struct EditorRow) * (buf->numRows - at));
+	memcpy(&buf->row[at], rows, sizeof(struct EditorRow) * n);
 
-	ec.row[at].rsize = 0;
-	ec.row[at].render = NULL;
+	for (int j = 0; j < n; j++) {
+		buf->row[at + j].rsize = 0;
+		buf->row[at + j].render = NULL;
+		buf->row[at + j].cols = NULL;
+		buf->row[at + j].hash = 0;
+		buf->row[at + j].indexed = 0;
+	}
 
-	editor_update_row(&ec.row[at]);
+	buf->numRows += n;
+	buf->modified++;
+	editor_stats_insert(buf, at, n);
+	editor_complete_insert(buf, at, n);
 
-	ec.numRows++;
-	ec.modified++;
+	editor_journal_insert_rows(buf, at, &buf->row[at], n);
 }
 
 void editor_free_row(struct EditorRow* row) {
+	free(row->cols);
 	free(row->render);
 	free(row->chars);
 }
 
 void editor_del_row(int at) {
-	if (at < 0 || at >= ec.numRows) {
+	if (at < 0 || at >= ec.buf->numRows) {
+		return;
+	}
+
+	editor_buffer_unshare(ec.buf);
+	editor_cold_thaw(ec.buf, at, at + 1);
+	editor_cold_move(ec.buf, at + 1, -1);
+	editor_diff_move(ec.buf, at, -1);
+	editor_stats_remove(ec.buf, at, 1);
+	editor_complete_remove(ec.buf, at, 1);
+
+	editor_free_row(&ec.buf->row[at]);
+	memmove(&ec.buf->row[at], &ec.buf->row[at + 1], sizeof(struct EditorRow) * (ec.buf->numRows - at - 1));
+	ec.buf->numRows--;
+	ec.buf->modified++;
+
+	editor_journal_record(ec.buf, JOURNAL_DELETE_ROWS, at, 1, 0, NULL, 0);
+}
+
+/* Takes the n rows of buf starting at index at out of the row array with a single move
+ * With out set, the rows are handed over there (without their render caches), otherwise they are freed
+ */
+void editor_remove_rows(struct EditorBuffer* buf, int at, int n, struct EditorRow* out) {
+	if (at < 0 || n <= 0 || at + n > buf->numRows) {
 		return;
 	}
 
-	editor_free_row(&ec.row[at]);
-	memmove(&ec.row[at], &ec.row[at + 1], sizeof(struct EditorRow) * (ec.numRows - at - 1));
-	ec.numRows--;
-	ec.modified++;
+	editor_buffer_unshare(buf);
+	editor_cold_thaw(buf, at, at + n);
+	editor_cold_move(buf, at + n, -n);
+	editor_diff_move(buf, at, -n);
+	editor_stats_remove(buf, at, n);
+	editor_complete_remove(buf, at, n);
+
+	for (int j = 0; j < n; j++) {
+		struct EditorRow* row = &buf->row[at + j];
+
+		if (out) {
+			free(row->render);
+			free(row->cols);
+			out[j].size = row->size;
+			out[j].chars = row->chars;
+			out[j].rsize = 0;
+			out[j].render = NULL;
+			out[j].cols = NULL;
+			out[j].hash = row->hash;
+			out[j].indexed = 0;
+		} else {
+			editor_free_row(row);
+		}
+	}
+
+	memmove(&buf->row[at], &buf->row[at + n], sizeof(struct EditorRow) * (buf->numRows - at - n));
+	buf->numRows -= n;
+	buf->modified++;
+
+	editor_journal_record(buf, JOURNAL_DELETE_ROWS, at, n, 0, NULL, 0);
 }
 
 void editor_row_insert_char(struct EditorRow* row, int at, int c) {
@@ -388,6 +1168,9 @@ void editor_row_insert_char(struct EditorRow* row, int at, int c) {
 		at = row->size;
 	}
 
+	char ch = c;
+	editor_journal_splice(row, at, 0, &ch, 1);
+
 	row->chars = realloc(row->chars, row->size + 2);
 	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
 	row->size++;
@@ -396,12 +1179,46 @@ void editor_row_insert_char(struct EditorRow* row, int at, int c) {
 }
 
 void editor_row_append_string(struct EditorRow* row, char* s, size_t len) {
+	editor_journal_splice(row, row->size, 0, s, len);
+
 	row->chars = realloc(row->chars, row->size + len + 1);
 	memcpy(&row->chars[row->size], s, len);
 	row->size += len;
 	row->chars[row->size] = '\0';
 	editor_update_row(row);
-	ec.modified++;
+	ec.buf->modified++;
+}
+
+// Inserts the len bytes of s at index at of row with one reallocation
+void editor_row_insert_string(struct EditorRow* row, int at, char* s, size_t len) {
+	editor_journal_splice(row, at, 0, s, len);
+
+	row->chars = realloc(row->chars, row->size + len + 1);
+	memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+	memcpy(&row->chars[at], s, len);
+	row->size += len;
+	editor_update_row(row);
+}
+
+// Replaces the del bytes at index at of row with the len bytes of s, journaled as one splice and rebuilt once
+void editor_row_splice(struct EditorRow* row, int at, int del, char* s, size_t len) {
+	if (at < 0 || at > row->size) {
+		return;
+	}
+	if (del > row->size - at) {
+		del = row->size - at;
+	}
+
+	editor_journal_splice(row, at, del, s, len);
+
+	if ((int) len > del) {
+		row->chars = realloc(row->chars, row->size - del + len + 1);
+	}
+	memmove(&row->chars[at + len], &row->chars[at + del], row->size - at - del + 1);
+	memcpy(&row->chars[at], s, len);
+	row->size += len - del;
+	editor_update_row(row);
+	ec.buf->modified++;
 }
 
 void editor_row_del_char(struct EditorRow* row, int at) {
@@ -409,207 +1226,5709 @@ void editor_row_del_char(struct EditorRow* row, int at) {
 		return;
 	}
 
+	editor_journal_splice(row, at, 1, NULL, 0);
+
 	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
 	row->size--;
 	editor_update_row(row);
-	ec.modified++;
+	ec.buf->modified++;
 }
 
 /***** EDITOR OPERATIONS *****/
 
 void editor_insert_char(int c) {
-	if (ec.cury == ec.numRows) {
-		editor_insert_row(ec.numRows, "", 0);
+	editor_buffer_unshare(ec.buf);
+
+	if (ec.buf->cury == ec.buf->numRows) {
+		editor_insert_row(ec.buf->numRows, "", 0);
+	}
+	editor_cold_thaw(ec.buf, ec.buf->cury, ec.buf->cury + 1);
+
+	editor_row_insert_char(&ec.buf->row[ec.buf->cury], ec.buf->curx, c);
+	ec.buf->curx++;
+	ec.buf->modified++;
+}
+
+// Tells whether the default case of editor_process_keypress() inserts key as a character
+int editor_is_text_key(int key) {
+	return key == '\t' || (key >= ' ' && key < 256 && key != BACKSPACE);
+}
+
+// Inserts the len bytes of s at the cursor like as many editor_insert_char() calls, with one rebuild of the row
+void editor_insert_string(char* s, int len) {
+	editor_buffer_unshare(ec.buf);
+
+	if (ec.buf->cury == ec.buf->numRows) {
+		editor_insert_row(ec.buf->numRows, "", 0);
 	}
+	editor_cold_thaw(ec.buf, ec.buf->cury, ec.buf->cury + 1);
 
-	editor_row_insert_char(&ec.row[ec.cury], ec.curx, c);
-	ec.curx++;
-	ec.modified++;
+	editor_row_insert_string(&ec.buf->row[ec.buf->cury], ec.buf->curx, s, len);
+	ec.buf->curx += len;
+	ec.buf->modified++;
 }
 
 void editor_insert_newline(void) {
-	if (ec.curx == 0) {
-		editor_insert_row(ec.cury, "", 0);
+	editor_buffer_unshare(ec.buf);
+
+	if (ec.buf->curx == 0) {
+		editor_insert_row(ec.buf->cury, "", 0);
 	} else {
-		struct EditorRow* row = &ec.row[ec.cury];
-		editor_insert_row(ec.cury + 1, &row->chars[ec.curx], row->size - ec.curx);
-		row = &ec.row[ec.cury];
-		row->size = ec.curx;
+		editor_cold_thaw(ec.buf, ec.buf->cury, ec.buf->cury + 1);
+		struct EditorRow* row = &ec.buf->row[ec.buf->cury];
+		editor_insert_row(ec.buf->cury + 1, &row->chars[ec.buf->curx], row->size - ec.buf->curx);
+		row = &ec.buf->row[ec.buf->cury];
+		editor_journal_splice(row, ec.buf->curx, row->size - ec.buf->curx, NULL, 0);
+		row->size = ec.buf->curx;
 		row->chars[row->size] = '\0';
 		editor_update_row(row);
 	}
 
-	ec.cury++;
-	ec.curx = 0;
+	ec.buf->cury++;
+	ec.buf->curx = 0;
 }
 
 void editor_del_char(void) {
-	if (ec.cury == ec.numRows) {
+	if (ec.buf->cury == ec.buf->numRows) {
 		return;
 	}
 
-	if (ec.curx == 0 && ec.cury == 0) {
+	if (ec.buf->curx == 0 && ec.buf->cury == 0) {
 		return;
 	}
 
-	struct EditorRow* row = &ec.row[ec.cury];
-	if (ec.curx > 0) {
-		editor_row_del_char(row, ec.curx - 1);
-		ec.curx--;
+	editor_buffer_unshare(ec.buf);
+	editor_cold_thaw(ec.buf, ec.buf->curx > 0 ? ec.buf->cury : ec.buf->cury - 1, ec.buf->cury + 1);
+
+	struct EditorRow* row = &ec.buf->row[ec.buf->cury];
+	if (ec.buf->curx > 0) {
+		// A multi-byte character goes away as a whole, in one splice
+		int prev = editor_row_prev_char(row, ec.buf->curx);
+		editor_row_splice(row, prev, ec.buf->curx - prev, "", 0);
+		ec.buf->curx = prev;
 	} else {
-		ec.curx = ec.row[ec.cury - 1].size;
-		editor_row_append_string(&ec.row[ec.cury - 1], row->chars, row->size);
-		editor_del_row(ec.cury);
-		ec.cury--;
+		ec.buf->curx = ec.buf->row[ec.buf->cury - 1].size;
+		editor_row_append_string(&ec.buf->row[ec.buf->cury - 1], row->chars, row->size);
+		editor_del_row(ec.buf->cury);
+		ec.buf->cury--;
 	}
 }
 
-/***** FILE IO *****/
+/***** BUFFERS *****/
 
-char* editor_rows_to_string(int* buflen) {
-	int totlen = 0;
-	for (int j = 0; j < ec.numRows; j++) {
-		totlen += ec.row[j].size + 1;
+// Allocates an empty buffer and adds it to the buffer list
+struct EditorBuffer* editor_buffer_new(char* filename) {
+	struct EditorBuffer* buf = calloc(1, sizeof(struct EditorBuffer));
+	if (buf == NULL) {
+		die("editor_buffer_new()::calloc()");
+	}
+
+	buf->share = calloc(1, sizeof(struct RowShare));
+	if (buf->share == NULL) {
+		die("editor_buffer_new()::calloc()");
+	}
+	buf->share->refs = 1;
+	buf->share->lastViewed = time(NULL);
+
+	buf->filename = filename ? strdup(filename) : NULL;
+
+	ec.bufs = realloc(ec.bufs, sizeof(struct EditorBuffer*) * (ec.numBufs + 1));
+	buf->id = ec.numBufs;
+	ec.bufs[ec.numBufs++] = buf;
+
+	return buf;
+}
+
+/* Gives buf a private copy of its rows if they are still shared with another buffer
+ * Must be called before anything writes to buf->row
+ */
+void editor_buffer_unshare(struct EditorBuffer* buf) {
+	if (buf->share->refs == 1) {
+		return;
+	}
+
+	struct EditorRow* row = malloc(sizeof(struct EditorRow) * (buf->numRows ? buf->numRows : 1));
+	if (row == NULL) {
+		die("editor_buffer_unshare()::malloc()");
+	}
+
+	for (int j = 0; j < buf->numRows; j++) {
+		row[j].size = buf->row[j].size;
+
+		// Packed rows stay packed, their blocks are copied below
+		row[j].chars = NULL;
+		if (buf->row[j].chars) {
+			row[j].chars = malloc(row[j].size + 1);
+			if (row[j].chars == NULL) {
+				die("editor_buffer_unshare()::malloc()");
+			}
+			memcpy(row[j].chars, buf->row[j].chars, row[j].size + 1);
+		}
+
+		// Render is rebuilt lazily by editor_row_render()
+		row[j].rsize = 0;
+		row[j].render = NULL;
+		row[j].cols = NULL;
+		row[j].hash = buf->row[j].hash;
+		row[j].countedSize = buf->row[j].countedSize;
+		row[j].countedWords = buf->row[j].countedWords;
+		row[j].countedChars = buf->row[j].countedChars;
+		row[j].indexed = 0; // The copies are indexed by editor_complete_tick()
+	}
+
+	struct RowShare* old = buf->share;
+	old->refs--;
+
+	buf->share = calloc(1, sizeof(struct RowShare));
+	if (buf->share == NULL) {
+		die("editor_buffer_unshare()::calloc()");
+	}
+	buf->share->refs = 1;
+	buf->share->lastViewed = time(NULL);
+
+	// The counts come along, the tree is rebuilt for the copy when asked
+	buf->share->stats = old->stats;
+	buf->share->stats.tree = NULL;
+	buf->share->stats.treeCap = 0;
+	buf->share->stats.treeValid = 0;
+
+	if (old->numCold) {
+		buf->share->cold = malloc(sizeof(struct ColdBlock) * old->numCold);
+		if (buf->share->cold == NULL) {
+			die("editor_buffer_unshare()::malloc()");
+		}
+
+		for (int k = 0; k < old->numCold; k++) {
+			buf->share->cold[k] = old->cold[k];
+			buf->share->cold[k].packed = malloc(old->cold[k].packedLen ? old->cold[k].packedLen : 1);
+			if (buf->share->cold[k].packed == NULL) {
+				die("editor_buffer_unshare()::malloc()");
+			}
+			memcpy(buf->share->cold[k].packed, old->cold[k].packed, old->cold[k].packedLen);
+		}
+		buf->share->numCold = old->numCold;
+	}
+
+	buf->row = row;
+}
+
+// Shows buf in the active window, nothing is reloaded or re-rendered
+void editor_switch_buffer(struct EditorBuffer* buf) {
+	ec.win[ec.curWin].buf = buf;
+	ec.buf = buf;
+}
+
+void editor_next_buffer(int step) {
+	int id = (ec.buf->id + step + ec.numBufs) % ec.numBufs;
+	editor_switch_buffer(ec.bufs[id]);
+}
+
+/* Frees the render caches of buffers that have not been drawn for EDITOR_RENDER_IDLE seconds
+ * They come back on demand through editor_row_render()
+ */
+void editor_drop_idle_renders(void) {
+	time_t now = time(NULL);
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		struct EditorBuffer* buf = ec.bufs[i];
+		struct RowShare* share = buf->share;
+
+		if (share->rendersDropped || now - share->lastViewed < EDITOR_RENDER_IDLE) {
+			continue;
+		}
+
+		if (buf->view) {
+			// A view has no row array, its whole window of rows is read again when needed
+			editor_view_release(buf->view);
+		} else {
+			for (int j = 0; j < buf->numRows; j++) {
+				free(buf->row[j].render);
+				free(buf->row[j].cols);
+				buf->row[j].render = NULL;
+				buf->row[j].cols = NULL;
+				buf->row[j].rsize = 0;
+			}
+		}
+
+		share->rendersDropped = 1;
+	}
+}
+
+/***** COLD STORAGE *****/
+
+/* Rows far from every viewport are packed in blocks of EDITOR_COLD_ROWS when the chars and renders
+ * of a buffer grow past ec.coldBudget. A packed row keeps its size but has no chars, render or cols;
+ * editor_buffer_row() and the row operations unpack its whole block the first time it is touched again.
+ * Blocks use a byte oriented LZ77 format in the spirit of LZ4: a token holds the literal
+ * and match lengths, longer lengths continue in extra bytes, matches reach 64 KiB back
+ */
+
+#define LZ_HASH_BITS 14
+
+uint32_t lz_read32(const char* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// Writes len - 15 as a run of 255 bytes closed by a smaller one, len being 15 or more
+char* lz_put_length(char* op, int len) {
+	len -= 15;
+	while (len >= 255) {
+		*op++ = (char)255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+// Room needed to compress len bytes whatever they hold
+int lz_bound(int len) {
+	return len + len / 255 + 16;
+}
+
+// Compresses len bytes of src into dst, which holds lz_bound(len) bytes, returns the compressed length
+int lz_compress(const char* src, int len, char* dst) {
+	int32_t table[1 << LZ_HASH_BITS];
+	memset(table, 0xff, sizeof table);
+
+	char* op = dst;
+	int anchor = 0;
+	int i = 0;
+
+	while (i + 4 <= len) {
+		uint32_t h = (lz_read32(&src[i]) * 2654435761U) >> (32 - LZ_HASH_BITS);
+		int cand = table[h];
+		table[h] = i;
+
+		if (cand < 0 || i - cand > 65535 || lz_read32(&src[cand]) != lz_read32(&src[i])) {
+			i++;
+			continue;
+		}
+
+		int match = 4;
+		while (i + match < len && src[cand + match] == src[i + match]) {
+			match++;
+		}
+
+		int lit = i - anchor;
+		char* token = op++;
+		*token = (lit < 15 ? lit : 15) << 4 | (match - 4 < 15 ? match - 4 : 15);
+		if (lit >= 15) {
+			op = lz_put_length(op, lit);
+		}
+		memcpy(op, &src[anchor], lit);
+		op += lit;
+
+		*op++ = (i - cand) & 0xff;
+		*op++ = (i - cand) >> 8;
+		if (match - 4 >= 15) {
+			op = lz_put_length(op, match - 4);
+		}
+
+		i += match;
+		anchor = i;
+	}
+
+	// The last sequence is only literals
+	int lit = len - anchor;
+	*op++ = (lit < 15 ? lit : 15) << 4;
+	if (lit >= 15) {
+		op = lz_put_length(op, lit);
+	}
+	memcpy(op, &src[anchor], lit);
+	op += lit;
+
+	return op - dst;
+}
+
+// Reads the rest of a length whose 4 bits in the token were all set, returns -1 past the end of src
+int lz_get_length(const unsigned char* src, int srcLen, int* ip, int len) {
+	unsigned char b;
+	do {
+		if (*ip >= srcLen) {
+			return -1;
+		}
+		b = src[(*ip)++];
+		len += b;
+	} while (b == 255);
+
+	return len;
+}
+
+// Decompresses srcLen bytes of src into the dstLen bytes of dst, returns -1 if they don't decode to exactly that
+int lz_decompress(const char* src, int srcLen, char* dst, int dstLen) {
+	const unsigned char* s = (const unsigned char*)src;
+	int ip = 0;
+	int op = 0;
+
+	while (ip < srcLen) {
+		int token = s[ip++];
+
+		int lit = token >> 4;
+		if (lit == 15 && (lit = lz_get_length(s, srcLen, &ip, lit)) == -1) {
+			return -1;
+		}
+		if (lit > srcLen - ip || lit > dstLen - op) {
+			return -1;
+		}
+		memcpy(&dst[op], &s[ip], lit);
+		ip += lit;
+		op += lit;
+
+		if (ip == srcLen) {
+			break;
+		}
+
+		if (srcLen - ip < 2) {
+			return -1;
+		}
+		int off = s[ip] | s[ip + 1] << 8;
+		ip += 2;
+
+		int match = token & 15;
+		if (match == 15 && (match = lz_get_length(s, srcLen, &ip, match)) == -1) {
+			return -1;
+		}
+		match += 4;
+
+		if (off == 0 || off > op || match > dstLen - op) {
+			return -1;
+		}
+
+		// Overlapping matches repeat the bytes they just wrote, so they are copied one at a time
+		if (off >= match) {
+			memcpy(&dst[op], &dst[op - off], match);
+			op += match;
+		} else {
+			while (match--) {
+				dst[op] = dst[op - off];
+				op++;
+			}
+		}
+	}
+
+	return op == dstLen ? 0 : -1;
+}
+
+// Returns the index of the first block of share that ends after row at
+int editor_cold_find(struct RowShare* share, int at) {
+	int lo = 0;
+	int hi = share->numCold;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (share->cold[mid].first + share->cold[mid].count <= at) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+// Unpacks block k of buf back into its rows and forgets it
+void editor_cold_unpack(struct EditorBuffer* buf, int k) {
+	struct RowShare* share = buf->share;
+	struct ColdBlock* b = &share->cold[k];
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char* raw = malloc(b->rawLen ? b->rawLen : 1);
+	if (raw == NULL) {
+		die("editor_cold_unpack()::malloc()");
+	}
+	if (lz_decompress(b->packed, b->packedLen, raw, b->rawLen) == -1) {
+		die("editor_cold_unpack()::lz_decompress()");
+	}
+
+	char* p = raw;
+	for (int j = b->first; j < b->first + b->count; j++) {
+		struct EditorRow* row = &buf->row[j];
+		row->chars = malloc(row->size + 1);
+		if (row->chars == NULL) {
+			die("editor_cold_unpack()::malloc()");
+		}
+		memcpy(row->chars, p, row->size);
+		row->chars[row->size] = '\0';
+		p += row->size;
+	}
+
+	free(raw);
+	free(b->packed);
+
+	// Remembered so the next packing pass leaves these rows alone for a while
+	share->recent[share->numRecent++ % EDITOR_COLD_RECENT] = b->first;
+	share->recentTime = time(NULL);
+
+	memmove(b, b + 1, sizeof(struct ColdBlock) * (share->numCold - k - 1));
+	share->numCold--;
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ec.coldUnpacks++;
+	ec.coldUnpackMs += (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+}
+
+// Unpacks every block of buf holding one of the rows from to to - 1
+void editor_cold_thaw(struct EditorBuffer* buf, int from, int to) {
+	struct RowShare* share = buf->share;
+	int k = editor_cold_find(share, from);
+
+	while (k < share->numCold && share->cold[k].first < to) {
+		editor_cold_unpack(buf, k);
+	}
+}
+
+// Returns the chars of row at of the buffer of r, valid until the next call; those of a packed row aren't nul terminated
+char* editor_cold_peek(struct ColdReader* r, int at) {
+	struct EditorBuffer* buf = r->buf;
+	if (buf->row[at].chars) {
+		return buf->row[at].chars;
+	}
+
+	if (at < r->first || at >= r->first + r->count) {
+		struct ColdBlock* b = &buf->share->cold[editor_cold_find(buf->share, at)];
+
+		if (b->rawLen > r->rawCap) {
+			r->rawCap = b->rawLen;
+			r->raw = realloc(r->raw, r->rawCap);
+			if (r->raw == NULL) {
+				die("editor_cold_peek()::realloc()");
+			}
+		}
+		if (lz_decompress(b->packed, b->packedLen, r->raw, b->rawLen) == -1) {
+			die("editor_cold_peek()::lz_decompress()");
+		}
+
+		r->first = b->first;
+		r->count = b->count;
+		r->next = b->first;
+		r->off = 0;
+	}
+
+	// Rows are mostly asked for in order, so the offset of the next one is kept
+	if (at < r->next) {
+		r->next = r->first;
+		r->off = 0;
+	}
+	while (r->next < at) {
+		r->off += buf->row[r->next++].size;
+	}
+
+	return &r->raw[r->off];
+}
+
+/* Moves the blocks of buf starting at row at or after it by delta rows, for rows inserted or removed there
+ * A block that at splits is unpacked first
+ */
+void editor_cold_move(struct EditorBuffer* buf, int at, int delta) {
+	struct RowShare* share = buf->share;
+	if (share->numCold == 0) {
+		return;
+	}
+
+	int k = editor_cold_find(share, at);
+	if (k < share->numCold && share->cold[k].first < at) {
+		editor_cold_unpack(buf, k);
+	}
+
+	for (; k < share->numCold; k++) {
+		share->cold[k].first += delta;
+	}
+}
+
+// Packs rows first to first + count - 1 of buf, none of which is packed yet, into a new block
+void editor_cold_pack_rows(struct EditorBuffer* buf, int first, int count) {
+	struct RowShare* share = buf->share;
+
+	int rawLen = 0;
+	for (int j = first; j < first + count; j++) {
+		rawLen += buf->row[j].size;
+	}
+
+	char* raw = malloc(rawLen ? rawLen : 1);
+	char* packed = malloc(lz_bound(rawLen));
+	if (raw == NULL || packed == NULL) {
+		die("editor_cold_pack_rows()::malloc()");
+	}
+
+	char* p = raw;
+	for (int j = first; j < first + count; j++) {
+		struct EditorRow* row = &buf->row[j];
+		memcpy(p, row->chars, row->size);
+		p += row->size;
+
+		// Kept for the diff gutter, which then never has to unpack the block
+		if (row->hash == 0) {
+			row->hash = editor_hash_bytes(row->chars, row->size);
+		}
+		// Same for the completion index
+		editor_complete_learn(row);
+
+		editor_free_row(row);
+		row->chars = NULL;
+		row->render = NULL;
+		row->cols = NULL;
+		row->rsize = 0;
+	}
+
+	int packedLen = lz_compress(raw, rawLen, packed);
+	free(raw);
+
+	int k = editor_cold_find(share, first);
+	share->cold = realloc(share->cold, sizeof(struct ColdBlock) * (share->numCold + 1));
+	memmove(&share->cold[k + 1], &share->cold[k], sizeof(struct ColdBlock) * (share->numCold - k));
+	share->numCold++;
+
+	struct ColdBlock* b = &share->cold[k];
+	b->first = first;
+	b->count = count;
+	b->rawLen = rawLen;
+	b->packedLen = packedLen;
+	b->packed = realloc(packed, packedLen ? packedLen : 1);
+}
+
+// Bytes of chars, renders and columns held by the unpacked rows of buf
+size_t editor_cold_resident(struct EditorBuffer* buf) {
+	size_t bytes = 0;
+
+	for (int j = 0; j < buf->numRows; j++) {
+		struct EditorRow* row = &buf->row[j];
+		if (row->chars) {
+			bytes += row->size + 1 + row->rsize + (row->cols ? sizeof(int) * (row->size + 1) : 0);
+		}
+	}
+
+	return bytes;
+}
+
+// A range of rows that may be packed, see editor_cold_pack()
+struct ColdCandidate {
+	struct EditorBuffer* buf;
+	int first;
+	int count;
+	size_t bytes;
+	long distance; // Rows to the closest viewport or cursor of a buffer sharing the rows
+};
+
+int editor_cold_candidate_cmp(const void* a, const void* b) {
+	long da = ((const struct ColdCandidate*)a)->distance;
+	long db = ((const struct ColdCandidate*)b)->distance;
+
+	return da < db ? 1 : da > db ? -1 : 0;
+}
+
+/* Packs the rows farthest from what is on screen until the unpacked rows of all buffers fit in ec.coldBudget
+ * Ranges near a cursor or a viewport, and ranges unpacked in the last EDITOR_COLD_IDLE seconds, are kept
+ * unless all is set, which packs every row whatever the budget. Returns the number of rows packed
+ */
+int editor_cold_pack(int all) {
+	time_t now = time(NULL);
+
+	// Buffers sharing their rows are counted and packed once
+	size_t resident = 0;
+	int numOwners = 0;
+	struct EditorBuffer** owners = malloc(sizeof(struct EditorBuffer*) * (ec.numBufs ? ec.numBufs : 1));
+	if (owners == NULL) {
+		die("editor_cold_pack()::malloc()");
+	}
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		struct EditorBuffer* buf = ec.bufs[i];
+		int seen = buf->view != NULL;
+
+		for (int k = 0; k < numOwners && !seen; k++) {
+			seen = owners[k]->share == buf->share;
+		}
+
+		if (!seen) {
+			owners[numOwners++] = buf;
+			resident += editor_cold_resident(buf);
+		}
+	}
+
+	if (resident <= ec.coldBudget && !all) {
+		free(owners);
+		return 0;
+	}
+
+	struct ColdCandidate* cand = NULL;
+	int numCand = 0;
+	int capCand = 0;
+
+	for (int o = 0; o < numOwners; o++) {
+		struct EditorBuffer* buf = owners[o];
+		struct RowShare* share = buf->share;
+
+		for (int first = 0; first < buf->numRows; first += EDITOR_COLD_ROWS) {
+			int count = buf->numRows - first < EDITOR_COLD_ROWS ? buf->numRows - first : EDITOR_COLD_ROWS;
+
+			int recent = 0;
+			for (int r = 0; r < EDITOR_COLD_RECENT && r < share->numRecent; r++) {
+				recent |= share->recent[r] < first + count && share->recent[r] + EDITOR_COLD_ROWS > first;
+			}
+			if (recent && now - share->recentTime < EDITOR_COLD_IDLE && !all) {
+				continue;
+			}
+
+			size_t bytes = 0;
+			int packed = 0;
+			for (int j = first; j < first + count && !packed; j++) {
+				struct EditorRow* row = &buf->row[j];
+				packed = row->chars == NULL;
+				bytes += row->size + 1 + row->rsize + (row->cols ? sizeof(int) * (row->size + 1) : 0);
+			}
+			if (packed) {
+				continue;
+			}
+
+			long distance = LONG_MAX;
+			for (int i = 0; i < ec.numBufs; i++) {
+				struct EditorBuffer* other = ec.bufs[i];
+				if (other->share != share) {
+					continue;
+				}
+
+				long d = other->cury < first ? first - other->cury : other->cury - (first + count - 1);
+				distance = d < distance ? d : distance;
+
+				for (int w = 0; w < ec.numWins; w++) {
+					if (ec.win[w].buf != other) {
+						continue;
+					}
+
+					int top = other->rowOffset;
+					int bottom = top + ec.win[w].rows - 1;
+					d = bottom < first ? first - bottom : top > first + count - 1 ? top - (first + count - 1) : 0;
+					distance = d < distance ? d : distance;
+				}
+			}
+
+			if (distance < EDITOR_COLD_ROWS && !all) {
+				continue;
+			}
+
+			if (numCand == capCand) {
+				capCand = capCand ? capCand * 2 : 64;
+				cand = realloc(cand, sizeof(struct ColdCandidate) * capCand);
+				if (cand == NULL) {
+					die("editor_cold_pack()::realloc()");
+				}
+			}
+			cand[numCand++] = (struct ColdCandidate){ buf, first, count, bytes, distance };
+		}
+	}
+
+	qsort(cand, numCand, sizeof(struct ColdCandidate), editor_cold_candidate_cmp);
+
+	int rows = 0;
+	for (int c = 0; c < numCand && (resident > ec.coldBudget || all); c++) {
+		editor_cold_pack_rows(cand[c].buf, cand[c].first, cand[c].count);
+		resident -= cand[c].bytes;
+		rows += cand[c].count;
+	}
+
+	free(cand);
+	free(owners);
+
+	return rows;
+}
+
+// Sums the blocks of every buffer into *raw and *packed bytes
+void editor_cold_totals(size_t* raw, size_t* packed) {
+	*raw = 0;
+	*packed = 0;
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		struct RowShare* share = ec.bufs[i]->share;
+		int seen = 0;
+
+		for (int k = 0; k < i && !seen; k++) {
+			seen = ec.bufs[k]->share == share;
+		}
+
+		for (int k = 0; k < share->numCold && !seen; k++) {
+			*raw += share->cold[k].rawLen;
+			*packed += share->cold[k].packedLen;
+		}
+	}
+}
+
+/* Packs cold rows at most every EDITOR_COLD_INTERVAL seconds while the editor waits for keys
+ * Returns 1 if rows were packed, the status message tells how well
+ */
+int editor_cold_tick(void) {
+	static time_t last;
+	time_t now = time(NULL);
+
+	if (now - last < EDITOR_COLD_INTERVAL) {
+		return 0;
+	}
+	last = now;
+
+	int rows = editor_cold_pack(0);
+	if (rows == 0) {
+		return 0;
+	}
+
+	size_t raw, packed;
+	editor_cold_totals(&raw, &packed);
+	editor_set_status_message("Packed %d rows, %.1f MB in %.1f MB (%.1fx), unpacking %.2f ms", rows, raw / 1e6, packed / 1e6,
+			packed ? (double)raw / packed : 0.0, ec.coldUnpacks ? ec.coldUnpackMs / ec.coldUnpacks : 0.0);
+	return 1;
+}
+
+/* Loads filename, packs all of it and unpacks every block again in a random order
+ * then prints the compression ratio and how long an unpack takes
+ */
+int editor_bench_cold(char* filename) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (editor_open(filename) == -1) {
+		perror(filename);
+		return 1;
+	}
+	if (ec.buf->view) {
+		fprintf(stderr, "%s: too big to be held in memory\n", filename);
+		return 1;
+	}
+	double loadMs = editor_bench_ms(&start);
+
+	size_t resident = editor_cold_resident(ec.buf);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int rows = editor_cold_pack(1);
+	double packMs = editor_bench_ms(&start);
+
+	size_t raw, packed;
+	editor_cold_totals(&raw, &packed);
+	int blocks = ec.buf->share->numCold;
+
+	printf("loaded %d rows in %.1f ms, %.1f MB of chars and renders\n", ec.buf->numRows, loadMs, resident / 1e6);
+	if (blocks == 0) {
+		printf("no blocks packed\n");
+		return 0;
+	}
+
+	printf("packed %d rows in %d blocks in %.1f ms: %.1f MB of chars in %.1f MB (%.2fx)\n", rows, blocks, packMs,
+			raw / 1e6, packed / 1e6, packed ? (double)raw / packed : 0.0);
+
+	double worst = 0;
+	srand(1);
+	while (ec.buf->share->numCold > 0) {
+		struct ColdBlock* b = &ec.buf->share->cold[rand() % ec.buf->share->numCold];
+		int at = b->first + rand() % b->count;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		struct EditorRow* row = editor_buffer_row(ec.buf, at);
+		editor_row_render(row);
+		double ms = editor_bench_ms(&start);
+		worst = ms > worst ? ms : worst;
+	}
+
+	printf("unpacked %d blocks: %.3f ms on average, %.3f ms at worst\n", blocks, ec.coldUnpackMs / ec.coldUnpacks, worst);
+
+	return 0;
+}
+
+/***** WINDOWS *****/
+
+// Splits the text area evenly between the windows, each one gets a status bar at its bottom
+void editor_layout_windows(void) {
+	int height = ec.textRows / ec.numWins;
+
+	for (int i = 0; i < ec.numWins; i++) {
+		ec.win[i].top = i * height;
+		ec.win[i].rows = height - 1;
+	}
+
+	// The last window takes the rows left over by the division
+	ec.win[ec.numWins - 1].rows += ec.textRows - height * ec.numWins;
+}
+
+void editor_focus_window(int idx) {
+	ec.curWin = idx;
+	ec.buf = ec.win[idx].buf;
+}
+
+void editor_split_window(void) {
+	if (ec.numWins == EDITOR_MAX_WINDOWS || ec.textRows / (ec.numWins + 1) < 2) {
+		editor_set_status_message("Not enough room for another window");
+		return;
+	}
+
+	// The new window opens right below the active one, on the same buffer
+	memmove(&ec.win[ec.curWin + 2], &ec.win[ec.curWin + 1], sizeof(struct EditorWindow) * (ec.numWins - ec.curWin - 1));
+	ec.win[ec.curWin + 1].buf = ec.buf;
+	ec.numWins++;
+
+	editor_layout_windows();
+	editor_focus_window(ec.curWin + 1);
+}
+
+void editor_close_window(void) {
+	if (ec.numWins == 1) {
+		editor_set_status_message("Can't close the last window");
+		return;
+	}
+
+	memmove(&ec.win[ec.curWin], &ec.win[ec.curWin + 1], sizeof(struct EditorWindow) * (ec.numWins - ec.curWin - 1));
+	ec.numWins--;
+
+	editor_layout_windows();
+	editor_focus_window(ec.curWin < ec.numWins ? ec.curWin : ec.numWins - 1);
+}
+
+/***** COMPRESSION *****/
+
+/* Gzip files are read and written through a small deflate codec of our own, nothing is stored uncompressed on disk
+ * Opening runs the decoder on a thread that hands over GZIP_CHUNK sized blocks through a queue
+ * of GZIP_QUEUE entries, so lines are split off one block while the next one is inflated.
+ * Saving streams the rows through an LZ77 matcher with fixed Huffman codes straight into the file
+ */
+
+#define GZIP_CHUNK (256 << 10) // Bytes of decompressed data handed over at once
+#define GZIP_QUEUE 4 // Chunks decompressed ahead of the line splitting
+#define GZIP_WINDOW 32768 // Farthest back reference of deflate
+#define GZIP_BLOCK (1 << 20) // Bytes compressed in one deflate block when saving
+#define GZIP_HASH_BITS 15
+
+static const uint16_t gzipLenBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t gzipLenExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t gzipDistBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+	4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t gzipDistExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static uint32_t gzipCrcTable[256];
+static uint16_t gzipFixedCode[288]; // Fixed literal/length codes, already bit reversed
+static uint8_t gzipFixedLen[288];
+
+// Reverses the low len bits of code, deflate sends Huffman codes starting from their top bit
+uint32_t gzip_reverse(uint32_t code, int len) {
+	uint32_t r = 0;
+	for (int i = 0; i < len; i++) {
+		r = (r << 1) | ((code >> i) & 1);
+	}
+	return r;
+}
+
+// Fills the tables above, must be called before any thread uses them
+void gzip_init(void) {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		gzipCrcTable[n] = c;
+	}
+
+	for (int sym = 0; sym < 288; sym++) {
+		if (sym < 144) {
+			gzipFixedLen[sym] = 8;
+			gzipFixedCode[sym] = gzip_reverse(0x30 + sym, 8);
+		} else if (sym < 256) {
+			gzipFixedLen[sym] = 9;
+			gzipFixedCode[sym] = gzip_reverse(0x190 + sym - 144, 9);
+		} else if (sym < 280) {
+			gzipFixedLen[sym] = 7;
+			gzipFixedCode[sym] = gzip_reverse(sym - 256, 7);
+		} else {
+			gzipFixedLen[sym] = 8;
+			gzipFixedCode[sym] = gzip_reverse(0xc0 + sym - 280, 8);
+		}
+	}
+}
+
+uint32_t gzip_crc(uint32_t crc, const unsigned char* p, size_t len) {
+	crc = ~crc;
+	while (len--) {
+		crc = gzipCrcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Huffman decoding table indexed by the next bits of the stream, entries are symbol << 4 | code length
+struct GzipHuffman {
+	int bits;
+	uint16_t table[1 << 15];
+};
+
+// Decompression state, shared with the decoding thread under lock
+struct GzipReader {
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char* queue[GZIP_QUEUE];
+	size_t queueLen[GZIP_QUEUE];
+	int head;
+	int count;
+	int done; // Set by the thread once everything is queued
+	int stop; // Set to make the thread give up
+	int error; // errno of the failure that ended the stream, EBADMSG for corrupt data
+
+	// Owned by the thread
+	unsigned char in[1 << 16];
+	size_t inPos;
+	size_t inLen;
+	uint64_t bits;
+	int numBits;
+	unsigned char hist[GZIP_WINDOW]; // Last bytes produced, for back references
+	uint32_t histPos;
+	uint32_t produced; // Bytes produced by the current member, modulo 2^32 like its trailer
+	uint32_t crc;
+	char* out;
+	size_t outLen;
+	size_t crcFrom; // Bytes of out already in crc
+	struct GzipHuffman lit;
+	struct GzipHuffman dist;
+};
+
+void gzip_refill(struct GzipReader* r) {
+	while (r->numBits <= 56) {
+		if (r->inPos == r->inLen) {
+			ssize_t n = read(r->fd, r->in, sizeof r->in);
+			if (n <= 0) {
+				if (n == -1 && errno != EINTR) {
+					r->error = errno;
+				}
+				if (n == 0 || r->error) {
+					return;
+				}
+				continue;
+			}
+			r->inPos = 0;
+			r->inLen = n;
+		}
+
+		r->bits |= (uint64_t)r->in[r->inPos++] << r->numBits;
+		r->numBits += 8;
+	}
+}
+
+// Takes n bits off the stream, running out of input is corrupt data
+uint32_t gzip_bits(struct GzipReader* r, int n) {
+	if (r->numBits < n) {
+		gzip_refill(r);
+		if (r->numBits < n) {
+			if (!r->error) {
+				r->error = EBADMSG;
+			}
+			r->numBits = n;
+		}
+	}
+
+	uint32_t v = r->bits & ((1ULL << n) - 1);
+	r->bits >>= n;
+	r->numBits -= n;
+	return v;
+}
+
+// Builds the canonical Huffman table of the code lengths lens, returns -1 if they don't make a valid code
+int gzip_huffman_build(struct GzipHuffman* h, const uint8_t* lens, int n) {
+	int count[16] = { 0 };
+	for (int i = 0; i < n; i++) {
+		count[lens[i]]++;
+	}
+	count[0] = 0;
+
+	int next[16];
+	int left = 1;
+	int code = 0;
+	h->bits = 1;
+	for (int len = 1; len < 16; len++) {
+		left = (left << 1) - count[len];
+		if (left < 0) {
+			return -1;
+		}
+		code = (code + count[len - 1]) << 1;
+		next[len] = code;
+		if (count[len]) {
+			h->bits = len;
+		}
+	}
+
+	memset(h->table, 0, sizeof(uint16_t) << h->bits);
+	for (int sym = 0; sym < n; sym++) {
+		int len = lens[sym];
+		if (len == 0) {
+			continue;
+		}
+
+		for (uint32_t i = gzip_reverse(next[len]++, len); i < 1U << h->bits; i += 1U << len) {
+			h->table[i] = sym << 4 | len;
+		}
+	}
+
+	return 0;
+}
+
+int gzip_decode(struct GzipReader* r, struct GzipHuffman* h) {
+	if (r->numBits < h->bits) {
+		gzip_refill(r);
+	}
+
+	uint16_t e = h->table[r->bits & ((1U << h->bits) - 1)];
+	if ((e & 15) == 0 || (e & 15) > r->numBits) {
+		r->error = r->error ? r->error : EBADMSG;
+		return -1;
+	}
+
+	r->bits >>= e & 15;
+	r->numBits -= e & 15;
+	return e >> 4;
+}
+
+// Hands the decompressed bytes in r->out to the reader, waiting while the queue is full
+void gzip_reader_push(struct GzipReader* r) {
+	r->crc = gzip_crc(r->crc, (unsigned char*)r->out + r->crcFrom, r->outLen - r->crcFrom);
+	r->crcFrom = 0;
+
+	pthread_mutex_lock(&r->lock);
+	while (r->count == GZIP_QUEUE && !r->stop) {
+		pthread_cond_wait(&r->cond, &r->lock);
+	}
+
+	if (r->stop) {
+		r->error = ECANCELED;
+	} else {
+		int tail = (r->head + r->count) % GZIP_QUEUE;
+		r->queue[tail] = r->out;
+		r->queueLen[tail] = r->outLen;
+		r->count++;
+		r->out = NULL;
+		pthread_cond_broadcast(&r->cond);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	if (r->out == NULL && (r->out = malloc(GZIP_CHUNK)) == NULL) {
+		die("gzip_reader_push()::malloc()");
+	}
+	r->outLen = 0;
+}
+
+void gzip_put(struct GzipReader* r, unsigned char c) {
+	r->hist[r->histPos++ & (GZIP_WINDOW - 1)] = c;
+	r->produced++;
+	r->out[r->outLen++] = c;
+
+	if (r->outLen == GZIP_CHUNK) {
+		gzip_reader_push(r);
+	}
+}
+
+// Decodes the code lengths of a dynamic block into r->lit and r->dist
+int gzip_dynamic_tables(struct GzipReader* r) {
+	static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	int numLit = gzip_bits(r, 5) + 257;
+	int numDist = gzip_bits(r, 5) + 1;
+	int numLens = gzip_bits(r, 4) + 4;
+
+	uint8_t lens[288 + 32] = { 0 };
+	for (int i = 0; i < numLens; i++) {
+		lens[order[i]] = gzip_bits(r, 3);
+	}
+	if (gzip_huffman_build(&r->lit, lens, 19) == -1) {
+		return -1;
+	}
+
+	memset(lens, 0, sizeof lens);
+	int i = 0;
+	while (i < numLit + numDist && !r->error) {
+		int sym = gzip_decode(r, &r->lit);
+		int repeat = 0;
+		int len = 0;
+
+		if (sym < 16) {
+			lens[i++] = sym;
+			continue;
+		} else if (sym == 16) {
+			if (i == 0) {
+				return -1;
+			}
+			len = lens[i - 1];
+			repeat = 3 + gzip_bits(r, 2);
+		} else if (sym == 17) {
+			repeat = 3 + gzip_bits(r, 3);
+		} else if (sym == 18) {
+			repeat = 11 + gzip_bits(r, 7);
+		} else {
+			return -1;
+		}
+
+		if (i + repeat > numLit + numDist) {
+			return -1;
+		}
+		while (repeat--) {
+			lens[i++] = len;
+		}
+	}
+
+	if (r->error || lens[256] == 0) {
+		return -1;
+	}
+
+	if (gzip_huffman_build(&r->lit, lens, numLit) == -1 || gzip_huffman_build(&r->dist, lens + numLit, numDist) == -1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+// Inflates one deflate block with the tables in r->lit and r->dist
+int gzip_inflate_codes(struct GzipReader* r) {
+	while (!r->error) {
+		int sym = gzip_decode(r, &r->lit);
+
+		if (sym < 256) {
+			if (sym < 0) {
+				return -1;
+			}
+			gzip_put(r, sym);
+			continue;
+		}
+
+		if (sym == 256) {
+			return 0;
+		}
+
+		sym -= 257;
+		if (sym >= 29) {
+			return -1;
+		}
+		int len = gzipLenBase[sym] + gzip_bits(r, gzipLenExtra[sym]);
+
+		int code = gzip_decode(r, &r->dist);
+		if (code < 0 || code >= 30) {
+			return -1;
+		}
+		uint32_t dist = gzipDistBase[code] + gzip_bits(r, gzipDistExtra[code]);
+		if (dist > r->produced && r->produced < GZIP_WINDOW) {
+			return -1;
+		}
+
+		while (len--) {
+			gzip_put(r, r->hist[(r->histPos - dist) & (GZIP_WINDOW - 1)]);
+		}
+	}
+
+	return -1;
+}
+
+// Inflates one gzip member, the stream is at its first byte
+int gzip_inflate_member(struct GzipReader* r) {
+	if (gzip_bits(r, 8) != 0x1f || gzip_bits(r, 8) != 0x8b || gzip_bits(r, 8) != 8) {
+		return -1;
+	}
+
+	int flags = gzip_bits(r, 8);
+	gzip_bits(r, 32); // Modification time
+	gzip_bits(r, 16); // Extra flags and OS
+
+	if (flags & 4) {
+		for (int extra = gzip_bits(r, 16); extra > 0 && !r->error; extra--) {
+			gzip_bits(r, 8);
+		}
+	}
+	for (int field = 8; field <= 16; field += 8) {
+		// Zero terminated file name and comment
+		if (flags & field) {
+			while (gzip_bits(r, 8) != 0 && !r->error) {
+			}
+		}
+	}
+	if (flags & 2) {
+		gzip_bits(r, 16);
+	}
+
+	r->produced = 0;
+	r->crc = 0;
+	r->crcFrom = r->outLen;
+
+	int final;
+	do {
+		final = gzip_bits(r, 1);
+		int type = gzip_bits(r, 2);
+
+		if (type == 0) {
+			gzip_bits(r, r->numBits % 8);
+			uint32_t len = gzip_bits(r, 16);
+			if ((gzip_bits(r, 16) ^ 0xffff) != len) {
+				return -1;
+			}
+			while (len-- && !r->error) {
+				gzip_put(r, gzip_bits(r, 8));
+			}
+		} else if (type == 1) {
+			static uint8_t fixed[288 + 32];
+			if (fixed[0] == 0) {
+				memset(fixed, 8, 144);
+				memset(fixed + 144, 9, 112);
+				memset(fixed + 256, 7, 24);
+				memset(fixed + 280, 8, 8);
+				memset(fixed + 288, 5, 32);
+			}
+			gzip_huffman_build(&r->lit, fixed, 288);
+			gzip_huffman_build(&r->dist, fixed + 288, 32);
+
+			if (gzip_inflate_codes(r) == -1) {
+				return -1;
+			}
+		} else if (type == 2) {
+			if (gzip_dynamic_tables(r) == -1 || gzip_inflate_codes(r) == -1) {
+				return -1;
+			}
+		} else {
+			return -1;
+		}
+	} while (!final && !r->error);
+
+	gzip_bits(r, r->numBits % 8);
+	r->crc = gzip_crc(r->crc, (unsigned char*)r->out + r->crcFrom, r->outLen - r->crcFrom);
+	r->crcFrom = r->outLen;
+
+	uint32_t crc = gzip_bits(r, 16);
+	crc |= gzip_bits(r, 16) << 16;
+	uint32_t size = gzip_bits(r, 16);
+	size |= gzip_bits(r, 16) << 16;
+
+	return r->error || crc != r->crc || size != r->produced ? -1 : 0;
+}
+
+void* gzip_reader_thread(void* arg) {
+	struct GzipReader* r = arg;
+
+	/* Concatenated members, like appended log rotations, read as one stream
+	 * Bytes after a member that don't start another one, like the zeros of a padded tape block, end it quietly as in gzip
+	 */
+	do {
+		if (gzip_inflate_member(r) == -1 && !r->error) {
+			r->error = EBADMSG;
+		}
+		gzip_refill(r);
+	} while (!r->error && r->numBits >= 16 && (r->bits & 0xffff) == 0x8b1f);
+
+	if (!r->error && r->outLen > 0) {
+		gzip_reader_push(r);
+	}
+
+	pthread_mutex_lock(&r->lock);
+	r->done = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+struct GzipReader* gzip_reader_start(int fd) {
+	struct GzipReader* r = calloc(1, sizeof(struct GzipReader));
+	if (r == NULL || (r->out = malloc(GZIP_CHUNK)) == NULL) {
+		die("gzip_reader_start()::malloc()");
+	}
+
+	r->fd = fd;
+	gzip_init();
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	if (pthread_create(&r->thread, NULL, gzip_reader_thread, r) != 0) {
+		die("gzip_reader_start()::pthread_create()");
+	}
+
+	return r;
+}
+
+/* Waits for the next decompressed chunk and stores it in *chunk, to be freed by the caller
+ * Returns its length, 0 at the end of the stream or -1 with errno set if the stream is broken
+ */
+ssize_t gzip_reader_next(struct GzipReader* r, char** chunk) {
+	pthread_mutex_lock(&r->lock);
+	while (r->count == 0 && !r->done) {
+		pthread_cond_wait(&r->cond, &r->lock);
+	}
+
+	ssize_t len = 0;
+	if (r->count > 0) {
+		*chunk = r->queue[r->head];
+		len = r->queueLen[r->head];
+		r->head = (r->head + 1) % GZIP_QUEUE;
+		r->count--;
+		pthread_cond_broadcast(&r->cond);
+	} else if (r->error) {
+		errno = r->error;
+		len = -1;
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return len;
+}
+
+void gzip_reader_finish(struct GzipReader* r) {
+	pthread_mutex_lock(&r->lock);
+	r->stop = 1;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+
+	pthread_join(r->thread, NULL);
+
+	while (r->count > 0) {
+		free(r->queue[r->head]);
+		r->head = (r->head + 1) % GZIP_QUEUE;
+		r->count--;
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->cond);
+	free(r->out);
+	free(r);
+}
+
+/* Decompresses the gzip file fd into *rows, one per line, as the lines come out of the decoding thread
+ * Returns the number of rows, or -1 with errno set if the file is broken
+ */
+int gzip_read_rows(int fd, struct EditorRow** rows) {
+	struct GzipReader* r = gzip_reader_start(fd);
+
+	int numRows = 0;
+	int capRows = 0;
+	*rows = NULL;
+
+	// A line split between two chunks is gathered here
+	char* carry = NULL;
+	size_t carryLen = 0;
+
+	char* chunk;
+	ssize_t len;
+	while ((len = gzip_reader_next(r, &chunk)) > 0) {
+		char* p = chunk;
+		char* end = chunk + len;
+
+		while (p < end) {
+			char* nl = memchr(p, '\n', end - p);
+			char* stop = nl ? nl : end;
+
+			if (carryLen > 0 || nl == NULL) {
+				carry = realloc(carry, carryLen + (stop - p) + 1);
+				if (carry == NULL) {
+					die("gzip_read_rows()::realloc()");
+				}
+				memcpy(carry + carryLen, p, stop - p);
+				carryLen += stop - p;
+			}
+
+			if (nl == NULL) {
+				break;
+			}
+
+			char* line = carryLen > 0 ? carry : p;
+			size_t lineLen = carryLen > 0 ? carryLen : (size_t)(nl - p);
+			while (lineLen > 0 && line[lineLen - 1] == '\r') {
+				lineLen--;
+			}
+
+			if (numRows == capRows) {
+				capRows = capRows ? capRows * 2 : 1024;
+				*rows = realloc(*rows, sizeof(struct EditorRow) * capRows);
+				if (*rows == NULL) {
+					die("gzip_read_rows()::realloc()");
+				}
+			}
+
+			struct EditorRow* row = &(*rows)[numRows++];
+			row->size = lineLen;
+			row->chars = malloc(lineLen + 1);
+			if (row->chars == NULL) {
+				die("gzip_read_rows()::malloc()");
+			}
+			memcpy(row->chars, line, lineLen);
+			row->chars[lineLen] = '\0';
+
+			carryLen = 0;
+			p = nl + 1;
+		}
+
+		free(chunk);
+	}
+
+	int saved = errno;
+	gzip_reader_finish(r);
+
+	if (len == -1) {
+		for (int i = 0; i < numRows; i++) {
+			free((*rows)[i].chars);
+		}
+		free(*rows);
+		free(carry);
+		errno = saved;
+		return -1;
+	}
+
+	// A last line without a trailing newline still counts as a row
+	if (carryLen > 0) {
+		while (carryLen > 0 && carry[carryLen - 1] == '\r') {
+			carryLen--;
+		}
+		if (numRows == capRows) {
+			*rows = realloc(*rows, sizeof(struct EditorRow) * (capRows + 1));
+			if (*rows == NULL) {
+				die("gzip_read_rows()::realloc()");
+			}
+		}
+		(*rows)[numRows].size = carryLen;
+		(*rows)[numRows].chars = carry;
+		carry[carryLen] = '\0';
+		numRows++;
+		carry = NULL;
+	}
+
+	free(carry);
+	return numRows;
+}
+
+// Compression state of gzip_write_rows()
+struct GzipWriter {
+	int fd;
+	int error;
+	unsigned char* win; // The last GZIP_WINDOW bytes already compressed, then the bytes of the next block
+	size_t histLen;
+	size_t len;
+	int32_t head[1 << GZIP_HASH_BITS]; // Last position of win where each hashed 3 bytes were seen, -1 if none
+	uint64_t bits;
+	int numBits;
+	unsigned char out[1 << 16];
+	size_t outLen;
+	uint32_t crc;
+	uint32_t total;
+	size_t written;
+};
+
+void gzip_flush(struct GzipWriter* w) {
+	size_t off = 0;
+	while (off < w->outLen && !w->error) {
+		ssize_t n = write(w->fd, w->out + off, w->outLen - off);
+		if (n == -1 && errno != EINTR) {
+			w->error = errno;
+		} else if (n > 0) {
+			off += n;
+		}
+	}
+
+	w->written += w->outLen;
+	w->outLen = 0;
+}
+
+void gzip_put_bits(struct GzipWriter* w, uint32_t v, int n) {
+	w->bits |= (uint64_t)v << w->numBits;
+	w->numBits += n;
+
+	while (w->numBits >= 8) {
+		w->out[w->outLen++] = w->bits;
+		w->bits >>= 8;
+		w->numBits -= 8;
+
+		if (w->outLen == sizeof w->out) {
+			gzip_flush(w);
+		}
+	}
+}
+
+void gzip_put_fixed(struct GzipWriter* w, int sym) {
+	gzip_put_bits(w, gzipFixedCode[sym], gzipFixedLen[sym]);
+}
+
+void gzip_put_match(struct GzipWriter* w, int len, uint32_t dist) {
+	int code = 28;
+	while (gzipLenBase[code] > len) {
+		code--;
+	}
+	gzip_put_fixed(w, 257 + code);
+	gzip_put_bits(w, len - gzipLenBase[code], gzipLenExtra[code]);
+
+	code = 29;
+	while (gzipDistBase[code] > dist) {
+		code--;
+	}
+	gzip_put_bits(w, gzip_reverse(code, 5), 5);
+	gzip_put_bits(w, dist - gzipDistBase[code], gzipDistExtra[code]);
+}
+
+uint32_t gzip_hash(const unsigned char* p) {
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761U) >> (32 - GZIP_HASH_BITS);
+}
+
+// Compresses the bytes of w->win after its history as one fixed Huffman block
+void gzip_deflate_block(struct GzipWriter* w, int final) {
+	gzip_put_bits(w, final, 1);
+	gzip_put_bits(w, 1, 2);
+
+	size_t i = w->histLen;
+	while (i < w->len) {
+		if (w->len - i >= 3) {
+			uint32_t h = gzip_hash(&w->win[i]);
+			int32_t cand = w->head[h];
+			w->head[h] = i;
+
+			if (cand >= 0 && i - cand <= GZIP_WINDOW && memcmp(&w->win[cand], &w->win[i], 3) == 0) {
+				size_t max = w->len - i < 258 ? w->len - i : 258;
+				size_t len = 3;
+				while (len < max && w->win[cand + len] == w->win[i + len]) {
+					len++;
+				}
+
+				gzip_put_match(w, len, i - cand);
+				for (size_t k = i + 1; k < i + len && k + 3 <= w->len; k++) {
+					w->head[gzip_hash(&w->win[k])] = k;
+				}
+				i += len;
+				continue;
+			}
+		}
+
+		gzip_put_fixed(w, w->win[i]);
+		i++;
+	}
+
+	gzip_put_fixed(w, 256);
+
+	// Only the last window of input is kept for the matches of the next block
+	if (w->len > GZIP_WINDOW) {
+		size_t shift = w->len - GZIP_WINDOW;
+		memmove(w->win, w->win + shift, GZIP_WINDOW);
+		for (int h = 0; h < 1 << GZIP_HASH_BITS; h++) {
+			w->head[h] = w->head[h] >= (int32_t)shift ? w->head[h] - (int32_t)shift : -1;
+		}
+		w->len = GZIP_WINDOW;
+	}
+	w->histLen = w->len;
+}
+
+void gzip_write(struct GzipWriter* w, const char* s, size_t len) {
+	w->crc = gzip_crc(w->crc, (const unsigned char*)s, len);
+	w->total += len;
+
+	while (len > 0) {
+		size_t room = GZIP_WINDOW + GZIP_BLOCK - w->len;
+		size_t n = len < room ? len : room;
+		memcpy(w->win + w->len, s, n);
+		w->len += n;
+		s += n;
+		len -= n;
+
+		if (w->len == GZIP_WINDOW + GZIP_BLOCK) {
+			gzip_deflate_block(w, 0);
+		}
+	}
+}
+
+/* Writes the rows of buf to fd as a gzip file, each followed by a newline
+ * Returns the number of compressed bytes written, or -1 with errno set
+ */
+ssize_t gzip_write_rows(int fd, struct EditorBuffer* buf) {
+	struct GzipWriter* w = calloc(1, sizeof(struct GzipWriter));
+	if (w == NULL || (w->win = malloc(GZIP_WINDOW + GZIP_BLOCK)) == NULL) {
+		die("gzip_write_rows()::malloc()");
+	}
+
+	w->fd = fd;
+	memset(w->head, 0xff, sizeof w->head);
+	gzip_init();
+
+	static const unsigned char header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+	memcpy(w->out, header, sizeof header);
+	w->outLen = sizeof header;
+
+	struct ColdReader reader = {.buf = buf};
+	for (int j = 0; j < buf->numRows && !w->error; j++) {
+		gzip_write(w, editor_cold_peek(&reader, j), buf->row[j].size);
+		gzip_write(w, "\n", 1);
+	}
+	free(reader.raw);
+
+	gzip_deflate_block(w, 1);
+	gzip_put_bits(w, 0, (8 - w->numBits % 8) % 8);
+	gzip_put_bits(w, w->crc & 0xffff, 16);
+	gzip_put_bits(w, w->crc >> 16, 16);
+	gzip_put_bits(w, w->total & 0xffff, 16);
+	gzip_put_bits(w, w->total >> 16, 16);
+	gzip_flush(w);
+
+	ssize_t written = w->error ? -1 : (ssize_t)w->written;
+	errno = w->error;
+
+	free(w->win);
+	free(w);
+	return written;
+}
+
+/***** FILE IO *****/
+
+char* editor_rows_to_string(int* buflen) {
+	int totlen = 0;
+	for (int j = 0; j < ec.buf->numRows; j++) {
+		totlen += ec.buf->row[j].size + 1;
 	}
 
 	*buflen = totlen;
 
-	char* buf = malloc(totlen);
-	char* p = buf;
+	char* buf = malloc(totlen);
+	char* p = buf;
+
+	struct ColdReader reader = {.buf = ec.buf};
+	for (int j = 0; j < ec.buf->numRows; j++) {
+		memcpy(p, editor_cold_peek(&reader, j), ec.buf->row[j].size);
+		p += ec.buf->row[j].size;
+		*p = '\n';
+		p++;
+	}
+	free(reader.raw);
+
+	return buf;
+}
+
+// Returns the path of a hidden file next to filename, .<name>.<suffix>, to be freed by the caller
+char* editor_sidecar_path(const char* filename, const char* suffix) {
+	const char* base = strrchr(filename, '/');
+	int dirLen = base ? base - filename + 1 : 0;
+	base = base ? base + 1 : filename;
+
+	char* path = malloc(dirLen + strlen(base) + strlen(suffix) + 3);
+	sprintf(path, "%.*s.%s.%s", dirLen, filename, base, suffix);
+
+	return path;
+}
+
+/* Opens filename in a new buffer and shows it in the active window
+ * Gzip files are decompressed as they are read, other files bigger than EDITOR_VIEW_THRESHOLD are opened in view mode
+ * Returns -1 if the file can't be opened
+ */
+int editor_open(char* filename) {
+	FILE* fp = fopen(filename, "r");
+	if (!fp) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fileno(fp), &st) == -1) {
+		fclose(fp);
+		return -1;
+	}
+
+	// Compressed files are told apart by their first bytes, whatever their name
+	unsigned char magic[4] = { 0 };
+	if (pread(fileno(fp), magic, sizeof magic, 0) == -1) {
+		fclose(fp);
+		return -1;
+	}
+
+	if (memcmp(magic, "\x28\xb5\x2f\xfd", 4) == 0) {
+		// Zstandard frames have no decoder here
+		fclose(fp);
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	struct EditorRow* rows = NULL;
+	int numRows = 0;
+	int compressed = magic[0] == 0x1f && magic[1] == 0x8b;
+
+	if (compressed) {
+		if ((numRows = gzip_read_rows(fileno(fp), &rows)) == -1) {
+			int saved = errno;
+			fclose(fp);
+			errno = saved;
+			return -1;
+		}
+	} else if (st.st_size > EDITOR_VIEW_THRESHOLD) {
+		fclose(fp);
+		return editor_open_view(filename);
+	}
+
+	struct EditorBuffer* buf = editor_buffer_new(filename);
+	buf->dev = st.st_dev;
+	buf->ino = st.st_ino;
+	buf->mtime = st.st_mtime;
+	buf->size = st.st_size;
+	buf->compressed = compressed;
+
+	// An unmodified buffer of the same file already holds what is on disk, share its rows
+	for (int i = 0; i < ec.numBufs - 1; i++) {
+		struct EditorBuffer* other = ec.bufs[i];
+
+		if (other->filename && !other->modified && other->dev == st.st_dev && other->ino == st.st_ino && other->mtime == st.st_mtime) {
+			fclose(fp);
+
+			for (int j = 0; j < numRows; j++) {
+				free(rows[j].chars);
+			}
+			free(rows);
+
+			free(buf->share);
+			buf->share = other->share;
+			buf->share->refs++;
+			buf->row = other->row;
+			buf->numRows = other->numRows;
+			buf->size = other->size;
+
+			editor_switch_buffer(buf);
+			return 0;
+		}
+	}
+
+	editor_switch_buffer(buf);
+	ec.journalPaused++;
+	ec.completePaused++; // Indexed afterwards by editor_complete_tick(), not on the way in
+
+	if (compressed) {
+		editor_insert_rows(buf, 0, rows, numRows);
+		free(rows);
+	} else {
+		char* line = NULL;
+		size_t lineCap = 0;
+		ssize_t lineLen;
+
+		while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
+			while (lineLen > 0 && (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\r')) {
+				lineLen--;
+			}
+
+			editor_insert_row(ec.buf->numRows, line, lineLen);
+		}
+
+		ec.buf->size = ftello(fp);
+		free(line);
+	}
+
+	fclose(fp);
+	ec.buf->modified = 0;
+	ec.journalPaused--;
+	ec.completePaused--;
+
+	editor_journal_recover(ec.buf);
+
+	return 0;
+}
+
+void editor_save(void) {
+	if (ec.buf->filename == NULL) {
+		ec.buf->filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
+		if (ec.buf->filename == NULL) {
+			editor_set_status_message("Save aborted");
+			return;
+		}
+	}
+
+	size_t nameLen = strlen(ec.buf->filename);
+	if (nameLen > 4 && strcmp(ec.buf->filename + nameLen - 4, ".zst") == 0) {
+		editor_set_status_message("%s: zstd compression isn't supported, save aborted", ec.buf->filename);
+		return;
+	}
+
+	// A file read compressed or named .gz is written compressed
+	int compressed = ec.buf->compressed || (nameLen > 3 && strcmp(ec.buf->filename + nameLen - 3, ".gz") == 0);
+
+	/* A compressed file is streamed into a new file next to it, which is renamed over it once complete,
+	 * so a full disk or a failure midway leaves the old file whole. No uncompressed copy is made
+	 */
+	char* tmp = NULL;
+	int fd;
+	if (compressed) {
+		struct stat old;
+		tmp = editor_sidecar_path(ec.buf->filename, "ted-save");
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, stat(ec.buf->filename, &old) == 0 ? old.st_mode & 07777 : 0644);
+	} else {
+		fd = open(ec.buf->filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	}
+
+	if (fd != -1) {
+		ssize_t len = -1;
+
+		if (compressed) {
+			len = gzip_write_rows(fd, ec.buf);
+			if (len != -1 && (fsync(fd) == -1 || rename(tmp, ec.buf->filename) == -1)) {
+				len = -1;
+			}
+		} else {
+			int textLen;
+			char* text = editor_rows_to_string(&textLen);
+
+			if (ftruncate(fd, textLen) != -1 && write(fd, text, textLen) == textLen) {
+				len = textLen;
+			}
+			free(text);
+		}
+
+		if (len != -1) {
+			close(fd);
+			free(tmp);
+			ec.buf->modified = 0;
+			ec.buf->compressed = compressed;
+
+			struct stat st;
+			if (stat(ec.buf->filename, &st) != -1) {
+				ec.buf->dev = st.st_dev;
+				ec.buf->ino = st.st_ino;
+				ec.buf->mtime = st.st_mtime;
+				ec.buf->size = st.st_size;
+			}
+
+			editor_journal_reset(ec.buf);
+			ec.buf->unjournaled = 0;
+			editor_diff_saved(ec.buf);
+
+			editor_set_status_message("%s: %zd bytes written to disk%s", ec.buf->filename, len, compressed ? " (gzip)" : "");
+			return;
+		}
+
+		int saved = errno;
+		close(fd);
+		if (tmp) {
+			unlink(tmp);
+		}
+		errno = saved;
+	}
+
+	free(tmp);
+	editor_set_status_message("%s: save failed! I/O error: %s", ec.buf->filename, strerror(errno));
+}
+
+/***** VIEW MODE *****/
+
+/* View mode keeps huge files on disk instead of in ec.buf->row
+ * Only every EDITOR_VIEW_STRIDE-th line offset is remembered, and a small window
+ * of rows around the viewport is read back with pread() when it is needed,
+ * so memory stays within a fixed budget whatever the size of the file
+ */
+
+/* Reads the line starting at *pos into row (only its first EDITOR_VIEW_MAX_LINE bytes), then moves *pos past it
+ * The line is only skipped when row is NULL
+ */
+void editor_view_read_line(struct ViewIndex* v, off_t* pos, struct EditorRow* row) {
+	size_t len = 0;
+	char* chars = NULL;
+	if (row) {
+		chars = malloc(EDITOR_VIEW_MAX_LINE + 1);
+		if (chars == NULL) {
+			die("editor_view_read_line()::malloc()");
+		}
+	}
+
+	while (*pos < v->size) {
+		if (*pos < v->chunkOff || *pos >= v->chunkOff + v->chunkLen) {
+			ssize_t n = pread(v->fd, v->chunk, EDITOR_VIEW_CHUNK, *pos);
+			if (n <= 0) {
+				break;
+			}
+
+			v->chunkOff = *pos;
+			v->chunkLen = n;
+		}
+
+		char* start = &v->chunk[*pos - v->chunkOff];
+		size_t avail = v->chunkOff + v->chunkLen - *pos;
+		char* nl = memchr(start, '\n', avail);
+		size_t take = nl ? (size_t) (nl - start) : avail;
+
+		if (chars && len < EDITOR_VIEW_MAX_LINE) {
+			size_t keep = take < EDITOR_VIEW_MAX_LINE - len ? take : EDITOR_VIEW_MAX_LINE - len;
+			memcpy(&chars[len], start, keep);
+			len += keep;
+		}
+
+		*pos += take;
+		if (nl) {
+			(*pos)++;
+			break;
+		}
+	}
+
+	if (row == NULL) {
+		return;
+	}
+
+	while (len > 0 && chars[len - 1] == '\r') {
+		len--;
+	}
+	chars[len] = '\0';
+
+	row->size = len;
+	row->chars = realloc(chars, len + 1);
+	row->rsize = 0;
+	row->render = NULL;
+	row->cols = NULL;
+	row->hash = 0;
+	row->indexed = -1; // Views are too big to be indexed
+}
+
+// Frees the rows materialized for the viewport
+void editor_view_release(struct ViewIndex* v) {
+	for (int j = 0; j < v->count; j++) {
+		editor_free_row(&v->rows[j]);
+	}
+
+	v->count = 0;
+}
+
+// Materializes a window of rows holding line at, starting from the closest known offset
+void editor_view_load(struct EditorBuffer* buf, long long at) {
+	struct ViewIndex* v = buf->view;
+
+	long long start = at - EDITOR_VIEW_WINDOW / 4;
+	if (start < 0) {
+		start = 0;
+	}
+
+	// Either the sparse index entry at or before start, or the end of the current window when scrolling forward
+	long long line = start / EDITOR_VIEW_STRIDE * EDITOR_VIEW_STRIDE;
+	off_t pos = v->offsets[start / EDITOR_VIEW_STRIDE];
+	long long next = v->first + v->count;
+	if (v->count && next <= start && next > line) {
+		line = next;
+		pos = v->end;
+	}
+
+	editor_view_release(v);
+
+	while (line < start) {
+		editor_view_read_line(v, &pos, NULL);
+		line++;
+	}
+
+	v->first = start;
+	while (v->count < EDITOR_VIEW_WINDOW && line < buf->numRows) {
+		editor_view_read_line(v, &pos, &v->rows[v->count]);
+		v->count++;
+		line++;
+	}
+
+	v->end = pos;
+}
+
+/* Extends the sparse line index with the bytes between v->size and the end of the file
+ * Returns -1 on read errors
+ */
+int editor_view_scan(struct ViewIndex* v) {
+	off_t pos = v->size;
+	ssize_t n;
+
+	while ((n = pread(v->fd, v->chunk, EDITOR_VIEW_CHUNK, pos)) > 0) {
+		char* p = v->chunk;
+		char* end = v->chunk + n;
+
+		while ((p = memchr(p, '\n', end - p)) != NULL) {
+			p++;
+			v->lines++;
+
+			if (v->lines % EDITOR_VIEW_STRIDE == 0) {
+				if (v->numOffsets == v->capOffsets) {
+					v->capOffsets *= 2;
+
+					if (v->map) {
+						// A mapped sidecar can't grow, the index moves to the heap
+						off_t* offsets = malloc(sizeof(off_t) * v->capOffsets);
+						if (offsets == NULL) {
+							die("editor_view_scan()::malloc()");
+						}
+						memcpy(offsets, v->offsets, sizeof(off_t) * v->numOffsets);
+						munmap(v->map, v->mapLen);
+						v->map = NULL;
+						v->offsets = offsets;
+					} else {
+						v->offsets = realloc(v->offsets, sizeof(off_t) * v->capOffsets);
+						if (v->offsets == NULL) {
+							die("editor_view_scan()::realloc()");
+						}
+					}
+				}
+
+				v->offsets[v->numOffsets++] = pos + (p - v->chunk);
+			}
+		}
+
+		// A last line without a trailing newline still counts as a row
+		v->partial = end[-1] != '\n';
+		pos += n;
+	}
+
+	// The scan went through v->chunk, so it no longer caches a block of the file
+	v->chunkLen = 0;
+	v->size = pos;
+
+	return n == -1 ? -1 : 0;
+}
+
+// Returns the number of rows of the buffer viewing v, rows are int so lines past INT_MAX can't be reached
+int editor_view_rows(struct ViewIndex* v) {
+	long long rows = v->lines + v->partial;
+	return rows < INT_MAX ? (int)rows : INT_MAX;
+}
+
+/* Builds the sparse line index of filename in one sequential pass and opens it read-only in a new buffer
+ * The index comes from the sidecar of filename instead when it still matches the file
+ * Returns -1 if the file can't be opened
+ */
+int editor_open_view(char* filename) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	struct ViewIndex* v = calloc(1, sizeof(struct ViewIndex));
+	if (v == NULL || (v->chunk = malloc(EDITOR_VIEW_CHUNK)) == NULL) {
+		die("editor_open_view()::malloc()");
+	}
+
+	v->fd = fd;
+
+	if (editor_index_load(v, filename, &st) == -1) {
+		v->offsets = malloc(sizeof(off_t) * 64);
+		v->offsets[0] = 0;
+		v->numOffsets = 1;
+		v->capOffsets = 64;
+
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+		if (editor_view_scan(v) == -1) {
+			int saved = errno;
+			close(fd);
+			free(v->chunk);
+			free(v->offsets);
+			free(v);
+			errno = saved;
+			return -1;
+		}
+
+		editor_index_store(v, filename, &st);
+	}
+
+	struct EditorBuffer* buf = editor_buffer_new(filename);
+	buf->dev = st.st_dev;
+	buf->ino = st.st_ino;
+	buf->mtime = st.st_mtime;
+	buf->size = v->size;
+	buf->view = v;
+	buf->numRows = editor_view_rows(v);
+
+	editor_switch_buffer(buf);
+	if (buf->numRows < v->lines + v->partial) {
+		editor_set_status_message("%s: only the first %d of %lld lines can be viewed", filename, buf->numRows,
+				v->lines + v->partial);
+	}
+
+	return 0;
+}
+
+// Returns row at of buf, reading it from disk first if buf is in view mode or unpacking it if it was packed
+struct EditorRow* editor_buffer_row(struct EditorBuffer* buf, int at) {
+	struct ViewIndex* v = buf->view;
+	if (v == NULL) {
+		if (buf->row[at].chars == NULL) {
+			editor_cold_thaw(buf, at, at + 1);
+		}
+		return &buf->row[at];
+	}
+
+	if (at < v->first || at >= v->first + v->count) {
+		editor_view_load(buf, at);
+	}
+
+	return &v->rows[at - v->first];
+}
+
+// Tells the user and returns 1 when the active buffer can't be edited
+int editor_read_only(void) {
+	if (ec.buf->view) {
+		editor_set_status_message("Buffer is in read-only view mode");
+		return 1;
+	}
+
+	if (ec.buf->filter) {
+		editor_set_status_message("Rows are being filtered through %s (Ctrl-b to stop)", ec.buf->filter->command);
+		return 1;
+	}
+
+	return 0;
+}
+
+/***** LINE INDEX CACHE *****/
+
+/* Scanning a multi-GB file for newlines is most of the time it takes to open it in view mode,
+ * so the sparse line index is kept next to the file in .<name>.ted-index once it is built.
+ * It is only trusted again when the size, mtime and inode of the file and a hash of
+ * EDITOR_INDEX_SAMPLES blocks spread over it still match, and is then mapped as is:
+ * opening costs a few reads whatever the size of the file
+ */
+
+#define INDEX_MAGIC "TEDI"
+#define INDEX_VERSION 2 // Version 1 had 32 bit line counts
+
+// The header is followed by numOffsets 64 bit line offsets
+struct IndexHeader {
+	char magic[4];
+	uint32_t version;
+	int64_t size; // Size, mtime and inode of the file the index was built from
+	int64_t mtime;
+	int64_t mtimeNsec;
+	uint64_t ino;
+	uint64_t sample; // See editor_index_sample()
+	uint32_t stride; // EDITOR_VIEW_STRIDE of the editor that wrote it
+	uint32_t partial;
+	uint64_t numOffsets;
+	uint64_t lines;
+};
+
+// Returns a FNV-1a hash of EDITOR_INDEX_SAMPLES blocks of fd, from its first to its last bytes
+uint64_t editor_index_sample(int fd, off_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	char block[4096];
+	off_t span = size > (off_t)sizeof block ? size - (off_t)sizeof block : 0;
+
+	for (int i = 0; i < EDITOR_INDEX_SAMPLES; i++) {
+		ssize_t n = pread(fd, block, sizeof block, span / (EDITOR_INDEX_SAMPLES - 1) * i);
+
+		for (ssize_t j = 0; j < n; j++) {
+			hash = (hash ^ (unsigned char)block[j]) * 1099511628211ULL;
+		}
+	}
+
+	return hash;
+}
+
+/* Maps the sidecar index of filename into v if it was built from the file st describes
+ * Returns -1 if there is no such index
+ */
+int editor_index_load(struct ViewIndex* v, const char* filename, struct stat* st) {
+	if (!EDITOR_INDEX_CACHE || sizeof(off_t) != sizeof(int64_t) || st->st_size < EDITOR_INDEX_MIN) {
+		return -1;
+	}
+
+	char* path = editor_sidecar_path(filename, "ted-index");
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	free(path);
+
+	struct stat ist;
+	if (fd == -1 || fstat(fd, &ist) == -1 || ist.st_size < (off_t)sizeof(struct IndexHeader)) {
+		if (fd != -1) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	void* map = mmap(NULL, ist.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	struct IndexHeader* h = map;
+
+	if (memcmp(h->magic, INDEX_MAGIC, 4) != 0 || h->version != INDEX_VERSION || h->stride != EDITOR_VIEW_STRIDE ||
+			h->size != st->st_size || h->mtime != st->st_mtim.tv_sec || h->mtimeNsec != st->st_mtim.tv_nsec ||
+			h->ino != st->st_ino || h->numOffsets == 0 ||
+			h->numOffsets != (uint64_t)(ist.st_size - sizeof *h) / sizeof(int64_t) ||
+			(ist.st_size - sizeof *h) % sizeof(int64_t) != 0 ||
+			h->sample != editor_index_sample(v->fd, st->st_size)) {
+		munmap(map, ist.st_size);
+		return -1;
+	}
+
+	v->map = map;
+	v->mapLen = ist.st_size;
+	v->offsets = (off_t*)(h + 1);
+	v->numOffsets = h->numOffsets;
+	v->capOffsets = h->numOffsets;
+	v->lines = h->lines;
+	v->partial = h->partial;
+	v->size = st->st_size;
+
+	return 0;
+}
+
+/* Writes the index of v to the sidecar of filename, st describes the file when the scan started
+ * Nothing is written when the file changed meanwhile or the sidecar can't be created
+ */
+void editor_index_store(struct ViewIndex* v, const char* filename, struct stat* st) {
+	if (!EDITOR_INDEX_CACHE || sizeof(off_t) != sizeof(int64_t) || v->size < EDITOR_INDEX_MIN || v->size != st->st_size) {
+		return;
+	}
+
+	struct IndexHeader h;
+	memset(&h, 0, sizeof h);
+	memcpy(h.magic, INDEX_MAGIC, 4);
+	h.version = INDEX_VERSION;
+	h.size = st->st_size;
+	h.mtime = st->st_mtim.tv_sec;
+	h.mtimeNsec = st->st_mtim.tv_nsec;
+	h.ino = st->st_ino;
+	h.sample = editor_index_sample(v->fd, st->st_size);
+	h.stride = EDITOR_VIEW_STRIDE;
+	h.numOffsets = v->numOffsets;
+	h.lines = v->lines;
+	h.partial = v->partial;
+
+	// Written aside and renamed over the old sidecar, so a reader never maps half an index
+	char* path = editor_sidecar_path(filename, "ted-index");
+	char* tmp = malloc(strlen(path) + sizeof ".tmp");
+	sprintf(tmp, "%s.tmp", path);
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd != -1) {
+		size_t len = sizeof(off_t) * v->numOffsets;
+		int ok = write(fd, &h, sizeof h) == sizeof h && write(fd, v->offsets, len) == (ssize_t)len;
+
+		if (close(fd) == -1 || !ok || rename(tmp, path) == -1) {
+			unlink(tmp);
+		}
+	}
+
+	free(tmp);
+	free(path);
+}
+
+double editor_bench_ms(struct timespec* start) {
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e3 + (end.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Opens filename in view mode without its sidecar, then again with the sidecar the first open wrote,
+ * and prints how long each took along with the time to reach its last row
+ * The pages of the file are dropped from the page cache first so the cold open really reads the disk
+ */
+int editor_bench_open(char* filename) {
+	char* path = editor_sidecar_path(filename, "ted-index");
+	unlink(path);
+	free(path);
+
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		perror(filename);
+		return 1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	const char* runs[] = { "cold", "warm" };
+	for (int i = 0; i < 2; i++) {
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (editor_open_view(filename) == -1) {
+			perror(filename);
+			return 1;
+		}
+		double openMs = editor_bench_ms(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (ec.buf->numRows > 0) {
+			editor_buffer_row(ec.buf, ec.buf->numRows - 1);
+		}
+		double lastMs = editor_bench_ms(&start);
+
+		printf("%s open: %10.3f ms, last row: %8.3f ms (%d lines, index %s)\n", runs[i], openMs, lastMs,
+				ec.buf->numRows, ec.buf->view->map ? "mapped" : "scanned");
+	}
+
+	return 0;
+}
+
+/***** FOLLOW MODE *****/
+
+/* Follow mode is like tail -f, inotify tells when the file of a buffer grows
+ * and only the new bytes are read and appended as rows
+ */
+
+// Appends s to the last row of buf, which was missing the end of its line
+void editor_follow_extend_last_row(struct EditorBuffer* buf, char* s, size_t len) {
+	editor_buffer_unshare(buf);
+	editor_cold_thaw(buf, buf->numRows - 1, buf->numRows);
+
+	struct EditorRow* row = &buf->row[buf->numRows - 1];
+	editor_complete_forget(row);
+	row->chars = realloc(row->chars, row->size + len + 1);
+	memcpy(&row->chars[row->size], s, len);
+	row->size += len;
+	row->chars[row->size] = '\0';
+	editor_update_row(row);
+	editor_diff_touch(buf, buf->numRows - 1);
+	editor_stats_touch(buf, buf->numRows - 1, buf->numRows);
+}
+
+// Appends the bytes written to the file of buf since the last call, returns 1 if rows changed
+int editor_follow_read(struct EditorBuffer* buf) {
+	struct FollowState* f = buf->follow;
+
+	struct stat st;
+	if (fstat(f->fd, &st) == -1 || st.st_size == f->off) {
+		return 0;
+	}
+
+	if (st.st_size < f->off) {
+		// Truncated, keep what we have and follow from the new end
+		editor_set_status_message("%s: file truncated", buf->filename);
+		f->off = st.st_size;
+		f->partial = 0;
+		return 0;
+	}
+
+	int atEnd = buf->cury >= buf->numRows - 1;
+
+	if (buf->view) {
+		struct ViewIndex* v = buf->view;
+		int had = buf->numRows;
+
+		editor_view_scan(v);
+		buf->numRows = editor_view_rows(v);
+
+		// The window may hold a last line that was still being written
+		if (v->first + v->count >= had) {
+			editor_view_release(v);
+		}
+
+		f->off = v->size;
+		if (atEnd && buf->numRows > 0) {
+			buf->cury = buf->numRows - 1;
+		}
+
+		return 1;
+	}
+
+	int modified = buf->modified;
+	ec.journalPaused++; // Appended bytes are already on disk
+
+	int rowsCap = 256;
+	int numNew = 0;
+	struct EditorRow* rows = malloc(sizeof(struct EditorRow) * rowsCap);
+
+	char* line = NULL; // Bytes of the line being split that precede the current chunk
+	size_t lineLen = 0;
+	char chunk[65536];
+	ssize_t n;
+
+	while ((n = pread(f->fd, chunk, sizeof chunk, f->off)) > 0) {
+		char* p = chunk;
+		char* end = chunk + n;
+		char* nl;
+
+		while ((nl = memchr(p, '\n', end - p)) != NULL || p < end) {
+			size_t len = (nl ? nl : end) - p;
+
+			line = realloc(line, lineLen + len + 1);
+			memcpy(&line[lineLen], p, len);
+			lineLen += len;
+			line[lineLen] = '\0';
+			p += len;
+
+			if (nl == NULL) {
+				break;
+			}
+			p++;
+
+			while (lineLen > 0 && line[lineLen - 1] == '\r') {
+				line[--lineLen] = '\0';
+			}
+
+			if (f->partial && buf->numRows > 0) {
+				// The first bytes finish the row that had no newline yet
+				editor_follow_extend_last_row(buf, line, lineLen);
+				free(line);
+				f->partial = 0;
+			} else {
+				if (numNew == rowsCap) {
+					rowsCap *= 2;
+					rows = realloc(rows, sizeof(struct EditorRow) * rowsCap);
+				}
+
+				rows[numNew++] = (struct EditorRow){.size = lineLen, .chars = line};
+			}
+
+			line = NULL;
+			lineLen = 0;
+		}
+
+		f->off += n;
+	}
+
+	editor_insert_rows(buf, buf->numRows, rows, numNew);
+	free(rows);
+
+	// Bytes after the last newline show up as a row that later writes complete
+	if (lineLen) {
+		if (f->partial && buf->numRows > 0) {
+			editor_follow_extend_last_row(buf, line, lineLen);
+		} else {
+			struct EditorRow last = {.size = lineLen, .chars = line};
+			editor_insert_rows(buf, buf->numRows, &last, 1);
+			line = NULL;
+		}
+		f->partial = 1;
+	}
+	free(line);
+
+	// Keep the viewport pinned to the end when the cursor was on the last row
+	if (atEnd && buf->numRows > 0) {
+		buf->cury = buf->numRows - 1;
+		buf->curx = 0;
+	}
+
+	// What was appended is on disk, it isn't an unsaved change
+	buf->modified = modified;
+	ec.journalPaused--;
+
+	return 1;
+}
+
+// Starts or stops following the file of the active buffer
+void editor_follow_toggle(void) {
+	struct EditorBuffer* buf = ec.buf;
+
+	if (buf->follow) {
+		inotify_rm_watch(ec.inotifyFd, buf->follow->wd);
+		close(buf->follow->fd);
+		free(buf->follow);
+		buf->follow = NULL;
+		editor_set_status_message("Stopped following %s", buf->filename);
+		return;
+	}
+
+	if (buf->filename == NULL || buf->modified) {
+		editor_set_status_message("Only an unmodified file can be followed");
+		return;
+	}
+
+	if (buf->compressed) {
+		editor_set_status_message("A compressed file can't be followed");
+		return;
+	}
+
+	if (ec.inotifyFd == -1) {
+		ec.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (ec.inotifyFd == -1) {
+			editor_set_status_message("inotify: %s", strerror(errno));
+			return;
+		}
+	}
+
+	struct FollowState* f = calloc(1, sizeof(struct FollowState));
+	f->fd = open(buf->filename, O_RDONLY | O_CLOEXEC);
+	f->wd = f->fd == -1 ? -1 : inotify_add_watch(ec.inotifyFd, buf->filename, IN_MODIFY);
+	if (f->wd == -1) {
+		editor_set_status_message("%s: can't follow: %s", buf->filename, strerror(errno));
+		if (f->fd != -1) {
+			close(f->fd);
+		}
+		free(f);
+		return;
+	}
+
+	// Whatever was written after the buffer was loaded gets appended right away
+	f->off = buf->size;
+
+	char last;
+	f->partial = f->off > 0 && pread(f->fd, &last, 1, f->off - 1) == 1 && last != '\n';
+
+	buf->follow = f;
+	buf->cury = buf->numRows > 0 ? buf->numRows - 1 : 0;
+	editor_follow_read(buf);
+	buf->size = f->off;
+
+	editor_set_status_message("Following %s (Ctrl-t to stop)", buf->filename);
+}
+
+/* Drains the pending inotify events and reads each grown file once, however many events it got
+ * Returns 1 if the screen needs a redraw
+ */
+int editor_follow_poll(void) {
+	if (ec.inotifyFd == -1) {
+		return 0;
+	}
+
+	char events[4096]; // Only drained, which file grew is found with fstat()
+	int changed = 0;
+	ssize_t n;
+
+	while ((n = read(ec.inotifyFd, events, sizeof events)) > 0) {
+		changed = 1;
+	}
+
+	if (!changed) {
+		return 0;
+	}
+
+	int redraw = 0;
+	for (int i = 0; i < ec.numBufs; i++) {
+		if (ec.bufs[i]->follow && editor_follow_read(ec.bufs[i])) {
+			ec.bufs[i]->size = ec.bufs[i]->follow->off;
+			redraw = 1;
+		}
+	}
+
+	return redraw;
+}
+
+/***** SELECTION *****/
+
+/* Ctrl-v starts selecting characters from the cursor, a second Ctrl-v selects whole lines
+ * The selection goes to a register shared by all buffers with Ctrl-c (copy) or Ctrl-x (cut)
+ * and comes back with Ctrl-y (paste). Every block operation splices the row array once,
+ * so its cost doesn't depend on the number of lines moved
+ */
+
+struct EditorRegister {
+	int numRows;
+	struct EditorRow* rows; // Only size and chars are used
+	int lines; // Set when whole lines were taken, they are pasted above the cursor line
+} reg;
+
+// Returns the row of buf holding position (*x, y), moving it to the end of the last row when it is past it
+int editor_clamp_position(struct EditorBuffer* buf, int y, int* x) {
+	if (y >= buf->numRows) {
+		y = buf->numRows - 1;
+		*x = editor_buffer_row(buf, y)->size;
+	} else if (*x > editor_buffer_row(buf, y)->size) {
+		// Edits made while selecting may have shortened the row
+		*x = editor_buffer_row(buf, y)->size;
+	}
+
+	return y;
+}
+
+/* Orders the anchor and the cursor of buf
+ * The selection starts at (*x0, *y0) and ends right before (*x1, *y1)
+ */
+void editor_selection_bounds(struct EditorBuffer* buf, int* x0, int* y0, int* x1, int* y1) {
+	int ax = buf->selx;
+	int ay = editor_clamp_position(buf, buf->sely, &ax);
+	int cx = buf->curx;
+	int cy = editor_clamp_position(buf, buf->cury, &cx);
+
+	if (ay < cy || (ay == cy && ax < cx)) {
+		*x0 = ax;
+		*y0 = ay;
+		*x1 = cx;
+		*y1 = cy;
+	} else {
+		*x0 = cx;
+		*y0 = cy;
+		*x1 = ax;
+		*y1 = ay;
+	}
+}
+
+// Sets [*start, *end) to the columns of row y of buf that are selected, empty if none are
+void editor_selection_cols(struct EditorBuffer* buf, int y, struct EditorRow* row, int* start, int* end) {
+	*start = 0;
+	*end = 0;
+
+	if (buf->select == SELECT_NONE || buf->numRows == 0) {
+		return;
+	}
+
+	int x0, y0, x1, y1;
+	editor_selection_bounds(buf, &x0, &y0, &x1, &y1);
+	if (y < y0 || y > y1) {
+		return;
+	}
+
+	*end = INT_MAX;
+	if (buf->select == SELECT_CHARS) {
+		if (y == y0) {
+			*start = editor_row_curx_to_rx(row, x0);
+		}
+		if (y == y1) {
+			*end = editor_row_curx_to_rx(row, x1);
+		}
+	}
+}
+
+// Cycles the selection of the active buffer through characters, lines and none
+void editor_toggle_selection(void) {
+	if (ec.buf->numRows == 0) {
+		return;
+	}
+
+	if (ec.buf->select == SELECT_NONE) {
+		ec.buf->select = SELECT_CHARS;
+		ec.buf->selx = ec.buf->curx;
+		ec.buf->sely = ec.buf->cury;
+	} else if (ec.buf->select == SELECT_CHARS) {
+		ec.buf->select = SELECT_LINES;
+	} else {
+		ec.buf->select = SELECT_NONE;
+	}
+}
+
+void editor_register_clear(void) {
+	for (int j = 0; j < reg.numRows; j++) {
+		free(reg.rows[j].chars);
+	}
+
+	free(reg.rows);
+	reg.rows = NULL;
+	reg.numRows = 0;
+}
+
+// Fills row with a copy of the len bytes of s, render caches left empty
+void editor_row_init(struct EditorRow* row, char* s, size_t len) {
+	row->size = len;
+	row->chars = malloc(len + 1);
+	memcpy(row->chars, s, len);
+	row->chars[len] = '\0';
+	row->rsize = 0;
+	row->render = NULL;
+	row->cols = NULL;
+	row->hash = 0;
+	row->indexed = 0;
+}
+
+// Copies the selection of the active buffer to the register, this works in view mode too
+void editor_copy(void) {
+	struct EditorBuffer* buf = ec.buf;
+	if (buf->select == SELECT_NONE || buf->numRows == 0) {
+		editor_set_status_message("Nothing selected (Ctrl-v to select)");
+		return;
+	}
+
+	int x0, y0, x1, y1;
+	editor_selection_bounds(buf, &x0, &y0, &x1, &y1);
+
+	editor_register_clear();
+	reg.lines = buf->select == SELECT_LINES;
+	reg.numRows = y1 - y0 + 1;
+	reg.rows = malloc(sizeof(struct EditorRow) * reg.numRows);
+
+	for (int y = y0; y <= y1; y++) {
+		struct EditorRow* row = editor_buffer_row(buf, y);
+		int from = (!reg.lines && y == y0) ? x0 : 0;
+		int to = (!reg.lines && y == y1) ? x1 : row->size;
+
+		editor_row_init(&reg.rows[y - y0], &row->chars[from], to - from);
+	}
+
+	buf->select = SELECT_NONE;
+	editor_set_status_message("%d line(s) copied", reg.numRows);
+}
+
+// Moves the selection of the active buffer to the register
+void editor_cut(void) {
+	struct EditorBuffer* buf = ec.buf;
+	if (buf->select == SELECT_NONE || buf->numRows == 0) {
+		editor_set_status_message("Nothing selected (Ctrl-v to select)");
+		return;
+	}
+
+	int x0, y0, x1, y1;
+	editor_selection_bounds(buf, &x0, &y0, &x1, &y1);
+
+	editor_buffer_unshare(buf);
+	editor_cold_thaw(buf, y0, y1 + 1);
+	editor_register_clear();
+	reg.lines = buf->select == SELECT_LINES;
+	reg.numRows = y1 - y0 + 1;
+	reg.rows = malloc(sizeof(struct EditorRow) * reg.numRows);
+
+	if (reg.lines) {
+		editor_remove_rows(buf, y0, reg.numRows, reg.rows);
+		buf->curx = 0;
+	} else {
+		struct EditorRow* first = &buf->row[y0];
+		struct EditorRow* last = &buf->row[y1];
+
+		if (y0 == y1) {
+			editor_journal_splice(first, x0, x1 - x0, NULL, 0);
+			editor_row_init(&reg.rows[0], &first->chars[x0], x1 - x0);
+			memmove(&first->chars[x0], &first->chars[x1], first->size - x1 + 1);
+			first->size -= x1 - x0;
+		} else {
+			// The first row keeps its head and takes the tail of the last one
+			editor_journal_splice(first, x0, first->size - x0, &last->chars[x1], last->size - x1);
+			editor_row_init(&reg.rows[0], &first->chars[x0], first->size - x0);
+			first->chars = realloc(first->chars, x0 + last->size - x1 + 1);
+			memcpy(&first->chars[x0], &last->chars[x1], last->size - x1 + 1);
+			first->size = x0 + last->size - x1;
+
+			// The rows below move to the register as they are, the last one cut down to its head
+			editor_remove_rows(buf, y0 + 1, y1 - y0, &reg.rows[1]);
+			struct EditorRow* head = &reg.rows[reg.numRows - 1];
+			head->size = x1;
+			head->chars[x1] = '\0';
+		}
+
+		editor_update_row(&buf->row[y0]);
+		buf->curx = x0;
+	}
+
+	buf->cury = y0;
+	buf->select = SELECT_NONE;
+	buf->modified++;
+	editor_set_status_message("%d line(s) cut", reg.numRows);
+}
+
+// Inserts the register at the cursor, whole lines go above the cursor line
+void editor_paste(void) {
+	struct EditorBuffer* buf = ec.buf;
+	if (reg.numRows == 0) {
+		editor_set_status_message("Nothing to paste");
+		return;
+	}
+
+	editor_buffer_unshare(buf);
+
+	int n = reg.numRows;
+	struct EditorRow* rows = malloc(sizeof(struct EditorRow) * n);
+
+	if (reg.lines) {
+		for (int j = 0; j < n; j++) {
+			editor_row_init(&rows[j], reg.rows[j].chars, reg.rows[j].size);
+		}
+
+		editor_insert_rows(buf, buf->cury, rows, n);
+		buf->curx = 0;
+	} else {
+		if (buf->cury == buf->numRows) {
+			editor_insert_row(buf->numRows, "", 0);
+		}
+		editor_cold_thaw(buf, buf->cury, buf->cury + 1);
+
+		struct EditorRow* row = &buf->row[buf->cury];
+		int x = buf->curx;
+
+		if (n == 1) {
+			editor_row_insert_string(row, x, reg.rows[0].chars, reg.rows[0].size);
+			buf->curx += reg.rows[0].size;
+		} else {
+			// The cursor row is split, its tail ends up after the last pasted line
+			struct EditorRow* tail = &reg.rows[n - 1];
+			for (int j = 1; j < n - 1; j++) {
+				editor_row_init(&rows[j - 1], reg.rows[j].chars, reg.rows[j].size);
+			}
+
+			struct EditorRow* last = &rows[n - 2];
+			last->size = tail->size + row->size - x;
+			last->chars = malloc(last->size + 1);
+			memcpy(last->chars, tail->chars, tail->size);
+			memcpy(&last->chars[tail->size], &row->chars[x], row->size - x + 1);
+			last->rsize = 0;
+			last->render = NULL;
+			last->cols = NULL;
+			last->hash = 0;
+
+			editor_journal_splice(row, x, row->size - x, NULL, 0);
+			row->size = x;
+			row->chars[x] = '\0';
+			editor_row_insert_string(row, x, reg.rows[0].chars, reg.rows[0].size);
+
+			editor_insert_rows(buf, buf->cury + 1, rows, n - 1);
+			buf->cury += n - 1;
+			buf->curx = tail->size;
+		}
+	}
+
+	free(rows);
+	buf->modified++;
+	editor_set_status_message("%d line(s) pasted", n);
+}
+
+/***** JOURNAL *****/
+
+/* Every change made to a named buffer is appended to a journal next to its file, .<name>.ted-journal,
+ * as compact binary records of the row operations. Records pile up in memory and are written
+ * and synced at most every EDITOR_JOURNAL_SYNC seconds while the editor waits for keys,
+ * so typing never waits on the disk. Saving empties the journal and quitting removes it;
+ * a journal left by a crash is offered for replay when its file is opened again
+ */
+
+#define JOURNAL_MAGIC "TEDJ"
+
+struct JournalHeader {
+	char magic[4];
+	uint32_t version;
+	int64_t size; // Size and mtime of the file the records apply to
+	int64_t mtime;
+};
+
+// Every record is this header followed by len bytes of payload
+struct JournalRecord {
+	uint32_t type;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t len;
+};
+
+int editor_journal_write_header(struct EditorBuffer* buf) {
+	struct JournalHeader h;
+	memcpy(h.magic, JOURNAL_MAGIC, 4);
+	h.version = 1;
+	h.size = buf->size;
+	h.mtime = buf->mtime;
+
+	return write(buf->journal->fd, &h, sizeof h) == sizeof h ? 0 : -1;
+}
+
+// Returns the buffer holding the journal at path, NULL if none does
+struct EditorBuffer* editor_journal_owner(const char* path) {
+	for (int i = 0; i < ec.numBufs; i++) {
+		if (ec.bufs[i]->journal && strcmp(ec.bufs[i]->journal->path, path) == 0) {
+			return ec.bufs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Creates the journal of buf on its first change, returns 0 when buf can't be journaled
+ * A file has one journal: another buffer of it hands its journal over once its own changes are saved,
+ * until then buf isn't journaled, nor afterwards until it is saved, as its records would miss those changes
+ */
+int editor_journal_start(struct EditorBuffer* buf) {
+	if (buf->noJournal || buf->unjournaled || buf->view || buf->filename == NULL) {
+		return 0;
+	}
+
+	char* path = editor_sidecar_path(buf->filename, "ted-journal");
+
+	struct EditorBuffer* owner = editor_journal_owner(path);
+	if (owner && owner->modified) {
+		free(path);
+		buf->unjournaled = 1;
+		return 0;
+	}
+	if (owner) {
+		editor_journal_close(owner, 0);
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1) {
+		free(path);
+		buf->noJournal = 1;
+		return 0;
+	}
+
+	buf->journal = calloc(1, sizeof(struct Journal));
+	buf->journal->fd = fd;
+	buf->journal->path = path;
+	buf->journal->lastSync = time(NULL);
+	buf->journal->lastRecord = -1;
+
+	if (editor_journal_write_header(buf) == -1) {
+		editor_journal_close(buf, 1);
+		buf->noJournal = 1;
+		return 0;
+	}
+
+	return 1;
+}
+
+// Queues the len bytes of s after the records of buf, nothing once a failed write closed its journal
+void editor_journal_append(struct EditorBuffer* buf, const void* s, size_t len) {
+	struct Journal* j = buf->journal;
+	if (j == NULL) {
+		return;
+	}
+
+	if (j->len + len > j->cap) {
+		j->cap = (j->len + len) * 2;
+		j->pending = realloc(j->pending, j->cap);
+		if (j->pending == NULL) {
+			die("editor_journal_append()::realloc()");
+		}
+	}
+
+	memcpy(&j->pending[j->len], s, len);
+	j->len += len;
+
+	// Keeps memory bounded when a single change is huge, the sync still waits for a pause
+	if (j->len > EDITOR_JOURNAL_MAX_PENDING) {
+		editor_journal_write(buf);
+	}
+}
+
+/* Queues a record for buf, its payload being the len bytes of s
+ * When s is NULL the caller queues the payload itself with editor_journal_append(), if 1 is returned
+ */
+int editor_journal_record(struct EditorBuffer* buf, int type, int a, int b, int c, const char* s, size_t len) {
+	if (ec.journalPaused || (buf->journal == NULL && !editor_journal_start(buf))) {
+		return 0;
+	}
+
+	struct Journal* j = buf->journal;
+	struct JournalRecord r = {type, a, b, c, len};
+
+	// Typing lands right after the last insertion, which then just grows
+	struct JournalRecord last;
+	int extend = 0;
+	if (type == JOURNAL_SPLICE && c == 0 && j->lastRecord != -1) {
+		memcpy(&last, &j->pending[j->lastRecord], sizeof last);
+		extend = last.type == JOURNAL_SPLICE && last.c == 0 && last.a == r.a && last.b + last.len == r.b;
+	}
+
+	if (extend) {
+		last.len += len;
+		memcpy(&j->pending[j->lastRecord], &last, sizeof last);
+	} else {
+		j->lastRecord = j->len;
+		editor_journal_append(buf, &r, sizeof r);
+	}
+
+	if (s && len) {
+		editor_journal_append(buf, s, len);
+	}
+
+	return 1;
+}
+
+// Journals a change of row, which belongs to the active buffer, at byte at: del bytes removed, len bytes of s inserted
+void editor_journal_splice(struct EditorRow* row, int at, int del, const char* s, size_t len) {
+	/* Every edit of the chars of a row passes here before it is made, the diff gutter and the statistics
+	 * hear about it too, and the old identifiers leave the completion index
+	 */
+	editor_diff_touch(ec.buf, row - ec.buf->row);
+	editor_stats_touch(ec.buf, row - ec.buf->row, row - ec.buf->row + 1);
+	editor_complete_forget(row);
+
+	if (ec.journalPaused) {
+		return;
+	}
+
+	editor_journal_record(ec.buf, JOURNAL_SPLICE, row - ec.buf->row, at, del, s, len);
+}
+
+// Journals the n rows inserted at index at of buf, each one followed by a newline
+void editor_journal_insert_rows(struct EditorBuffer* buf, int at, struct EditorRow* rows, int n) {
+	if (ec.journalPaused) {
+		return;
+	}
+
+	size_t len = 0;
+	for (int j = 0; j < n; j++) {
+		len += rows[j].size + 1;
+	}
+
+	// Straight from the rows, a big insertion goes out in pieces instead of being copied whole first
+	if (!editor_journal_record(buf, JOURNAL_INSERT_ROWS, at, n, 0, NULL, len)) {
+		return;
+	}
+
+	for (int j = 0; j < n && buf->journal; j++) {
+		editor_journal_append(buf, rows[j].chars, rows[j].size);
+		editor_journal_append(buf, "\n", 1);
+	}
+}
+
+/* Writes the queued records of buf to its journal, without syncing
+ * Records lost to a failed write would leave a gap the later ones can't be replayed over,
+ * so the journal is removed then and buf isn't journaled again until it is saved. Returns -1 in that case
+ */
+int editor_journal_write(struct EditorBuffer* buf) {
+	struct Journal* j = buf->journal;
+	size_t done = 0;
+
+	while (done < j->len) {
+		ssize_t n = write(j->fd, &j->pending[done], j->len - done);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			editor_set_status_message("%s: journal not written (%s), changes aren't journaled until saved",
+					buf->filename, n == -1 ? strerror(errno) : "disk full");
+			editor_journal_close(buf, 1);
+			buf->unjournaled = 1;
+			return -1;
+		}
+		done += n;
+	}
+
+	j->unsynced = j->unsynced || done > 0;
+	j->len = 0;
+	j->lastRecord = -1;
+	return 0;
+}
+
+// Writes and syncs the journals whose records waited long enough, called while no key is pressed
+void editor_journal_sync(void) {
+	time_t now = time(NULL);
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		struct Journal* j = ec.bufs[i]->journal;
+
+		if (j && (j->len || j->unsynced) && now - j->lastSync >= EDITOR_JOURNAL_SYNC) {
+			if (editor_journal_write(ec.bufs[i]) == -1) {
+				continue;
+			}
+			fdatasync(j->fd);
+			j->unsynced = 0;
+			j->lastSync = now;
+		}
+	}
+}
+
+// Empties the journal of buf once its changes are on disk
+void editor_journal_reset(struct EditorBuffer* buf) {
+	struct Journal* j = buf->journal;
+	if (j == NULL) {
+		return;
+	}
+
+	j->len = 0;
+	j->lastRecord = -1;
+
+	if (ftruncate(j->fd, 0) == -1 || lseek(j->fd, 0, SEEK_SET) == -1 || editor_journal_write_header(buf) == -1) {
+		editor_journal_close(buf, 1);
+	}
+}
+
+// Closes the journal of buf, deleting its file when unlinkFile is set
+void editor_journal_close(struct EditorBuffer* buf, int unlinkFile) {
+	struct Journal* j = buf->journal;
+	if (j == NULL) {
+		return;
+	}
+
+	close(j->fd);
+	if (unlinkFile) {
+		unlink(j->path);
+	}
+
+	free(j->path);
+	free(j->pending);
+	free(j);
+	buf->journal = NULL;
+}
+
+// Applies one journal record to the rows of buf, returns -1 if it doesn't fit them
+int editor_journal_apply(struct EditorBuffer* buf, struct JournalRecord* r, char* payload) {
+	switch (r->type) {
+		case JOURNAL_SPLICE:
+			{
+				if (r->a >= (uint32_t) buf->numRows) {
+					return -1;
+				}
+
+				editor_cold_thaw(buf, r->a, r->a + 1);
+				struct EditorRow* row = &buf->row[r->a];
+				if (r->b > (uint32_t) row->size || r->c > row->size - r->b) {
+					return -1;
+				}
+
+				editor_complete_forget(row);
+
+				int size = row->size - r->c + r->len;
+				if ((int) r->len > (int) r->c) {
+					row->chars = realloc(row->chars, size + 1);
+				}
+
+				memmove(&row->chars[r->b + r->len], &row->chars[r->b + r->c], row->size - r->b - r->c + 1);
+				memcpy(&row->chars[r->b], payload, r->len);
+				row->size = size;
+
+				// Rendered when drawn, a row edited many times is only rendered once
+				free(row->render);
+				free(row->cols);
+				row->render = NULL;
+				row->cols = NULL;
+				row->hash = 0;
+				editor_stats_touch(buf, r->a, r->a + 1);
+				editor_complete_learn(row);
+			}
+			break;
+
+		case JOURNAL_INSERT_ROWS:
+			{
+				if (r->a > (uint32_t) buf->numRows) {
+					return -1;
+				}
+
+				struct EditorRow* rows = malloc(sizeof(struct EditorRow) * (r->b ? r->b : 1));
+				char* p = payload;
+				char* end = payload + r->len;
+				uint32_t n = 0;
+
+				while (n < r->b && p < end) {
+					char* nl = memchr(p, '\n', end - p);
+					if (nl == NULL) {
+						break;
+					}
+
+					editor_row_init(&rows[n++], p, nl - p);
+					p = nl + 1;
+				}
+
+				editor_insert_rows(buf, r->a, rows, n);
+				free(rows);
+
+				if (n != r->b) {
+					return -1;
+				}
+			}
+			break;
+
+		case JOURNAL_DELETE_ROWS:
+			if (r->a + r->b > (uint32_t) buf->numRows) {
+				return -1;
+			}
+
+			editor_remove_rows(buf, r->a, r->b, NULL);
+			break;
+
+		case JOURNAL_REPLACE_ALL:
+			{
+				if (r->b > r->len) {
+					return -1;
+				}
+
+				char* find = strndup(payload, r->b);
+				char* with = strndup(&payload[r->b], r->len - r->b);
+				int changedRows, threads;
+				long count = editor_replace_buffer(buf, find, with, r->a, &changedRows, &threads);
+				free(find);
+				free(with);
+
+				if (count == -1) {
+					return -1;
+				}
+			}
+			break;
+
+		default:
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Offers to replay the journal left by a previous session over the freshly loaded rows of buf
+ * It only applies when the file is still the one the journal was started from
+ */
+void editor_journal_recover(struct EditorBuffer* buf) {
+	char* path = editor_sidecar_path(buf->filename, "ted-journal");
+
+	// The journal of a buffer still open on the file isn't left over from a crash
+	if (editor_journal_owner(path)) {
+		free(path);
+		return;
+	}
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	struct stat st;
+	struct JournalHeader h;
+
+	if (fd == -1 || fstat(fd, &st) == -1 || st.st_size <= (off_t) sizeof h ||
+			read(fd, &h, sizeof h) != sizeof h || memcmp(h.magic, JOURNAL_MAGIC, 4) != 0 ||
+			h.size != buf->size || h.mtime != buf->mtime) {
+		if (fd != -1) {
+			close(fd);
+		}
+		free(path);
+		return;
+	}
+
+	// Nobody can answer during a benchmark, the journal is kept for the next session and left alone
+	if (!ec.interactive) {
+		close(fd);
+		free(path);
+		buf->noJournal = 1;
+		return;
+	}
+
+	editor_set_status_message("%s has unsaved changes from a previous session, recover them? (y/n)", buf->filename);
+	editor_refresh_screen();
+
+	int c = editor_read_key();
+	if (c != 'y' && c != 'Y') {
+		close(fd);
+		unlink(path);
+		free(path);
+		editor_set_status_message("");
+		return;
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t len = st.st_size - sizeof h;
+	char* data = malloc(len);
+	size_t got = 0;
+	ssize_t n;
+	while (got < len && (n = read(fd, &data[got], len - got)) > 0) {
+		got += n;
+	}
+
+	editor_buffer_unshare(buf);
+	ec.journalPaused++;
+
+	// A record cut short by the crash ends the replay
+	size_t pos = 0;
+	int records = 0;
+	while (pos + sizeof(struct JournalRecord) <= got) {
+		struct JournalRecord r;
+		memcpy(&r, &data[pos], sizeof r);
+
+		if (r.len > got - pos - sizeof r || editor_journal_apply(buf, &r, &data[pos + sizeof r]) == -1) {
+			break;
+		}
+
+		pos += sizeof r + r.len;
+		records++;
+	}
+
+	ec.journalPaused--;
+	free(data);
+
+	// Keeps journaling in the same file, after the last good record
+	if (ftruncate(fd, sizeof h + pos) == -1 || lseek(fd, 0, SEEK_END) == -1) {
+		close(fd);
+		free(path);
+		return;
+	}
+
+	buf->journal = calloc(1, sizeof(struct Journal));
+	buf->journal->fd = fd;
+	buf->journal->path = path;
+	buf->journal->lastSync = time(NULL);
+	buf->journal->lastRecord = -1;
+
+	if (buf->cury >= buf->numRows) {
+		buf->cury = 0;
+		buf->curx = 0;
+	}
+	buf->modified = records > 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	editor_set_status_message("Recovered %d change(s) in %ld ms", records, ms);
+}
+
+// Removes every journal, the user chose to leave without saving
+void editor_journal_discard_all(void) {
+	for (int i = 0; i < ec.numBufs; i++) {
+		editor_journal_close(ec.bufs[i], 1);
+	}
+}
+
+/***** FIND *****/
+
+void editor_find_callback(char* query, int key) {
+	/* lastMatch will store the index of the last match is such match existed, or -1 if no such match existed */
+	static int lastMatch = -1;
+
+	/* direction will store the value 1 if it's forward and -1 if it's backward */
+	static int direction = 1;
+
+	if (key == '\r' || key == '\x1b') {
+		/* Restore lastMatch and direction's initial value */
+		lastMatch = -1;
+		direction = 1;
+		return;
+	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+		direction = 1;
+	} else if (key == ARROW_LEFT || key == ARROW_RIGHT) {
+		direction = -1;
+	} else {
+		lastMatch = -1;
+		direction = 1;
+	}
+
+	if (lastMatch == -1) {
+		direction = 1;
+	}
+
+	int current = lastMatch;
+	for (int i = 0; i < ec.buf->numRows; i++) {
+		current += direction;
+
+		/* Search wrapping logic */
+		if (current == -1) {
+			current = ec.buf->numRows - 1;
+		} else if (current == ec.buf->numRows) {
+			current = 0;
+		}
+
+		struct EditorRow* row = editor_buffer_row(ec.buf, current);
+		char* match = strstr(row->chars, query);
+		if (match) {
+			lastMatch = current;
+			ec.buf->cury = current;
+			ec.buf->curx = match - row->chars;
+			ec.buf->rowOffset = ec.buf->numRows;
+			break;
+		}
+	}
+}
+
+void editor_find(void) {
+	int savedCurx = ec.buf->curx;
+	int savedCury = ec.buf->cury;
+	int savedColOffset = ec.buf->colOffset;
+	int savedRowOffset = ec.buf->rowOffset;
+
+	char* query = editor_prompt("Search: %s (Use ESC/Arrows/Enter)", editor_find_callback);
+
+	if (query) {
+		free(query);
+	} else {
+		ec.buf->curx = savedCurx;
+		ec.buf->cury = savedCury;
+		ec.buf->colOffset = savedColOffset;
+		ec.buf->rowOffset = savedRowOffset;
+	}
+}
+
+/***** REPLACE *****/
+
+/* Replace-all splits the rows between threads, each one finds the matches of its rows
+ * and rebuilds every changed row once, in an allocation of the exact new size
+ * The row array isn't resized, so threads never touch the same memory
+ */
+
+struct ReplaceJob {
+	struct EditorRow* rows;
+	int numRows;
+
+	const char* find;
+	size_t findLen;
+	const char* with;
+	int isRegex;
+	regex_t re; // Each thread compiles its own, glibc serializes regexec() on a shared one
+
+	regmatch_t (*matches)[10]; // Matches of the current row, with their subexpressions
+	int capMatches;
+
+	long count; // Number of replaced matches
+	int changedRows;
+
+	// Indexed rows that changed, with the chars they had, see editor_complete_relearn()
+	struct ReplaceRetired {
+		struct EditorRow* row;
+		char* chars;
+		int size;
+	}* retired;
+	int numRetired;
+	int capRetired;
+};
+
+/* Writes the replacement text of match m found in src to dst, if not NULL, and returns its length
+ * In patterns, \0 to \9 stand for the subexpressions of the match and \\ for a backslash
+ */
+size_t editor_replace_expand(struct ReplaceJob* job, const char* src, regmatch_t* m, char* dst) {
+	size_t len = 0;
+
+	for (const char* w = job->with; *w; w++) {
+		if (job->isRegex && w[0] == '\\' && w[1] >= '0' && w[1] <= '9') {
+			regmatch_t* sub = &m[w[1] - '0'];
+			w++;
+
+			if (sub->rm_so != -1) {
+				if (dst) {
+					memcpy(&dst[len], &src[sub->rm_so], sub->rm_eo - sub->rm_so);
+				}
+				len += sub->rm_eo - sub->rm_so;
+			}
+			continue;
+		}
+
+		if (job->isRegex && w[0] == '\\' && w[1] == '\\') {
+			w++;
+		}
+
+		if (dst) {
+			dst[len] = *w;
+		}
+		len++;
+	}
+
+	return len;
+}
+
+// Finds the matches of row, then rebuilds it in one go if there were any
+void editor_replace_row(struct ReplaceJob* job, struct EditorRow* row) {
+	int n = 0;
+	int pos = 0;
+
+	while (pos <= row->size) {
+		regmatch_t m[10];
+
+		if (job->isRegex) {
+			if (regexec(&job->re, &row->chars[pos], 10, m, pos > 0 ? REG_NOTBOL : 0) != 0) {
+				break;
+			}
+
+			for (int k = 0; k < 10; k++) {
+				if (m[k].rm_so != -1) {
+					m[k].rm_so += pos;
+					m[k].rm_eo += pos;
+				}
+			}
+		} else {
+			char* hit = memmem(&row->chars[pos], row->size - pos, job->find, job->findLen);
+			if (hit == NULL) {
+				break;
+			}
+
+			m[0].rm_so = hit - row->chars;
+			m[0].rm_eo = m[0].rm_so + job->findLen;
+		}
+
+		// An empty match right after a match is not one, like sed does
+		int empty = m[0].rm_so == m[0].rm_eo;
+		if (!(empty && n > 0 && job->matches[n - 1][0].rm_eo == m[0].rm_so)) {
+			if (n == job->capMatches) {
+				job->capMatches = job->capMatches ? job->capMatches * 2 : 64;
+				job->matches = realloc(job->matches, sizeof(*job->matches) * job->capMatches);
+			}
+
+			memcpy(job->matches[n], m, sizeof m);
+			n++;
+		}
+
+		pos = empty ? m[0].rm_eo + 1 : m[0].rm_eo;
+	}
+
+	if (n == 0) {
+		return;
+	}
+
+	size_t size = row->size;
+	for (int k = 0; k < n; k++) {
+		size += editor_replace_expand(job, row->chars, job->matches[k], NULL);
+		size -= job->matches[k][0].rm_eo - job->matches[k][0].rm_so;
+	}
+
+	char* chars = malloc(size + 1);
+	size_t len = 0;
+	int from = 0;
+
+	for (int k = 0; k < n; k++) {
+		regmatch_t* m = job->matches[k];
+
+		memcpy(&chars[len], &row->chars[from], m[0].rm_so - from);
+		len += m[0].rm_so - from;
+		len += editor_replace_expand(job, row->chars, m, &chars[len]);
+		from = m[0].rm_eo;
+	}
+
+	memcpy(&chars[len], &row->chars[from], row->size - from);
+	len += row->size - from;
+	chars[len] = '\0';
+
+	// The completion index is left to the calling thread, it gets the old chars once the workers are done
+	if (row->indexed == 1) {
+		if (job->numRetired == job->capRetired) {
+			job->capRetired = job->capRetired ? job->capRetired * 2 : 64;
+			job->retired = realloc(job->retired, sizeof(*job->retired) * job->capRetired);
+		}
+
+		job->retired[job->numRetired].row = row;
+		job->retired[job->numRetired].chars = row->chars;
+		job->retired[job->numRetired].size = row->size;
+		job->numRetired++;
+	} else {
+		free(row->chars);
+	}
+
+	row->chars = chars;
+	row->size = len;
+	editor_update_row(row);
+
+	job->count += n;
+	job->changedRows++;
+}
+
+void* editor_replace_worker(void* arg) {
+	struct ReplaceJob* job = arg;
+
+	for (int j = 0; j < job->numRows; j++) {
+		editor_replace_row(job, &job->rows[j]);
+	}
+
+	return NULL;
+}
+
+// Returns the number of threads worth starting for a pass over numRows rows
+int editor_thread_count(int numRows) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	long threads = numRows / EDITOR_ROWS_PER_THREAD;
+
+	if (threads > cpus) {
+		threads = cpus;
+	}
+	if (threads > EDITOR_MAX_THREADS) {
+		threads = EDITOR_MAX_THREADS;
+	}
+
+	return threads < 1 ? 1 : threads;
+}
+
+/* Replaces every match of find in rows from to to - 1 of buf, which are unpacked, adding to *count and *changedRows
+ * Returns the number of threads that did it
+ */
+int editor_replace_rows(struct EditorBuffer* buf, int from, int to, char* find, char* with, int isRegex, long* count, int* changedRows) {
+	int threads = editor_thread_count(to - from);
+	struct ReplaceJob jobs[EDITOR_MAX_THREADS];
+	pthread_t tids[EDITOR_MAX_THREADS];
+	int per = (to - from) / threads;
+
+	for (int t = 0; t < threads; t++) {
+		struct ReplaceJob* job = &jobs[t];
+		memset(job, 0, sizeof *job);
+
+		job->rows = &buf->row[from + t * per];
+		job->numRows = t == threads - 1 ? to - from - t * per : per;
+		job->find = find;
+		job->findLen = strlen(find);
+		job->with = with;
+		job->isRegex = isRegex;
+
+		if (isRegex) {
+			regcomp(&job->re, find, REG_EXTENDED);
+		}
+	}
+
+	// The calling thread takes the first chunk itself
+	int started[EDITOR_MAX_THREADS] = {0};
+	for (int t = 1; t < threads; t++) {
+		started[t] = pthread_create(&tids[t], NULL, editor_replace_worker, &jobs[t]) == 0;
+		if (!started[t]) {
+			editor_replace_worker(&jobs[t]);
+		}
+	}
+	editor_replace_worker(&jobs[0]);
+
+	for (int t = 0; t < threads; t++) {
+		if (started[t]) {
+			pthread_join(tids[t], NULL);
+		}
+
+		*count += jobs[t].count;
+		*changedRows += jobs[t].changedRows;
+		free(jobs[t].matches);
+
+		for (int k = 0; k < jobs[t].numRetired; k++) {
+			struct ReplaceRetired* r = &jobs[t].retired[k];
+			editor_complete_relearn(r->row, r->chars, r->size);
+			free(r->chars);
+		}
+		free(jobs[t].retired);
+		if (isRegex) {
+			regfree(&jobs[t].re);
+		}
+	}
+
+	return threads;
+}
+
+// Replaces every match of find in the active buffer, find is a POSIX extended regex when isRegex is set
+/* Replaces every match of find in buf with with and journals it, the core of editor_replace_all() that
+ * the journal replays too. Returns the number of replacements, -1 if find is a bad pattern
+ */
+long editor_replace_buffer(struct EditorBuffer* buf, char* find, char* with, int isRegex, int* changedRows, int* threads) {
+	regex_t re;
+	if (isRegex) {
+		if (regcomp(&re, find, REG_EXTENDED)) {
+			return -1;
+		}
+		regfree(&re);
+	}
+
+	editor_buffer_unshare(buf);
+	editor_stats_sync(buf);
+
+	/* Runs of unpacked rows are replaced in one go, a packed block is unpacked, replaced and packed again
+	 * right away so the buffer never holds more unpacked rows than before. The rows of each part are
+	 * counted again while they are unpacked
+	 */
+	struct RowShare* share = buf->share;
+	long count = 0;
+	*changedRows = 0;
+	*threads = 1;
+
+	ec.completePaused++;
+	for (int j = 0; j < buf->numRows;) {
+		int k = editor_cold_find(share, j);
+		int packed = k < share->numCold && share->cold[k].first <= j;
+		int to = packed ? j + share->cold[k].count : k < share->numCold ? share->cold[k].first : buf->numRows;
+
+		if (packed) {
+			editor_cold_unpack(buf, k);
+		}
+
+		int before = *changedRows;
+		int used = editor_replace_rows(buf, j, to, find, with, isRegex, &count, changedRows);
+		*threads = used > *threads ? used : *threads;
+
+		if (*changedRows > before) {
+			editor_stats_touch(buf, j, to);
+			editor_stats_sync(buf);
+		}
+
+		if (packed) {
+			editor_cold_pack_rows(buf, j, to - j);
+		}
+
+		j = to;
+	}
+	ec.completePaused--;
+
+	if (count) {
+		buf->modified++;
+
+		// Journaled as one operation, replaying it is cheaper than storing every changed row
+		size_t findLen = strlen(find);
+		size_t withLen = strlen(with);
+		char* args = malloc(findLen + withLen + 1);
+		memcpy(args, find, findLen);
+		memcpy(&args[findLen], with, withLen);
+		editor_journal_record(buf, JOURNAL_REPLACE_ALL, isRegex, findLen, 0, args, findLen + withLen);
+		free(args);
+
+		// The workers cleared the hashes of the rows they changed
+		editor_diff_touch_changed(buf);
+	}
+
+	if (buf->cury < buf->numRows && buf->curx > buf->row[buf->cury].size) {
+		buf->curx = buf->row[buf->cury].size;
+	}
+
+	return count;
+}
+
+void editor_replace_all(char* find, char* with, int isRegex) {
+	regex_t re;
+	if (isRegex) {
+		int err = regcomp(&re, find, REG_EXTENDED);
+		if (err) {
+			char msg[64];
+			regerror(err, &re, msg, sizeof msg);
+			editor_set_status_message("Bad pattern: %s", msg);
+			return;
+		}
+		regfree(&re);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int changedRows, threads;
+	long count = editor_replace_buffer(ec.buf, find, with, isRegex, &changedRows, &threads);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+	editor_set_status_message("Replaced %ld match(es) in %d line(s), %d thread(s), %ld ms", count, changedRows, threads, ms);
+}
+
+// Asks what to replace and with what, a leading / makes the first answer a pattern
+void editor_replace(void) {
+	char* find = editor_prompt("Replace all: %s (ESC to cancel, /regex for a pattern)", NULL);
+	if (find == NULL) {
+		return;
+	}
+
+	int isRegex = find[0] == '/' && find[1] != '\0';
+
+	char* with = editor_prompt_input("With: %s (ESC to cancel)", NULL, 1);
+	if (with) {
+		editor_replace_all(isRegex ? &find[1] : find, with, isRegex);
+		free(with);
+	}
+
+	free(find);
+}
+
+/***** DIFF *****/
+
+/* Ctrl-d shows how the rows differ from the file on disk in a gutter: + added, ~ changed, - lines removed above.
+ * Rows are compared through the hash of their chars, cached in the row. Every row remembers the disk line it
+ * was matched with; an edit unmatches the rows it touches, and once typing pauses only the gaps between
+ * the matched rows around the edits are diffed again, with Myers' algorithm in linear space
+ */
+
+uint64_t editor_hash_bytes(const char* s, size_t len) {
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+
+	while (len >= 8) {
+		uint64_t w;
+		memcpy(&w, s, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+		s += 8;
+		len -= 8;
+	}
+
+	while (len--) {
+		h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+	}
+
+	h ^= h >> 29;
+	return h ? h : 1;
+}
+
+// Returns the hash of row at of buf, computing it if an edit cleared it
+uint64_t editor_row_hash(struct EditorBuffer* buf, int at) {
+	struct EditorRow* row = &buf->row[at];
+
+	if (row->hash == 0) {
+		row = editor_buffer_row(buf, at);
+		row->hash = editor_hash_bytes(row->chars, row->size);
+	}
+
+	return row->hash;
+}
+
+// One run of editor_diff_compare() over hashes a of rows and b of disk lines
+struct DiffRun {
+	const uint64_t* a;
+	const uint64_t* b;
+	int* match; // Set to off + j for each a[i] matched with b[j]
+	int off;
+	int* v1; // Furthest reaching paths, forward and backward
+	int* v2;
+};
+
+/* Finds the middle snake of a[a0..a1) and b[b0..b1) and stores its start in *x and *y, relative to a0 and b0
+ * Returns -1 if there is none or it costs more than EDITOR_DIFF_MAX_COST edits to find
+ */
+int editor_diff_bisect(struct DiffRun* r, int a0, int a1, int b0, int b1, int* x, int* y) {
+	const uint64_t* a = r->a + a0;
+	const uint64_t* b = r->b + b0;
+	int n = a1 - a0;
+	int m = b1 - b0;
+
+	int maxD = (n + m + 1) / 2;
+	int vOff = maxD;
+	int vLen = 2 * maxD + 2;
+	for (int i = 0; i < vLen; i++) {
+		r->v1[i] = -1;
+		r->v2[i] = -1;
+	}
+	r->v1[vOff + 1] = 0;
+	r->v2[vOff + 1] = 0;
+
+	int delta = n - m;
+	int front = delta % 2 != 0; // The forward paths meet the backward ones, or the other way around
+	int k1Start = 0, k1End = 0, k2Start = 0, k2End = 0;
+
+	for (int d = 0; d < maxD && d < EDITOR_DIFF_MAX_COST; d++) {
+		for (int k1 = -d + k1Start; k1 <= d - k1End; k1 += 2) {
+			int k1Off = vOff + k1;
+			int x1 = k1 == -d || (k1 != d && r->v1[k1Off - 1] < r->v1[k1Off + 1]) ? r->v1[k1Off + 1] : r->v1[k1Off - 1] + 1;
+			int y1 = x1 - k1;
+
+			while (x1 < n && y1 < m && a[x1] == b[y1]) {
+				x1++;
+				y1++;
+			}
+			r->v1[k1Off] = x1;
+
+			if (x1 > n) {
+				k1End += 2;
+			} else if (y1 > m) {
+				k1Start += 2;
+			} else if (front) {
+				int k2Off = vOff + delta - k1;
+				if (k2Off >= 0 && k2Off < vLen && r->v2[k2Off] != -1 && x1 >= n - r->v2[k2Off]) {
+					*x = x1;
+					*y = y1;
+					return 0;
+				}
+			}
+		}
+
+		for (int k2 = -d + k2Start; k2 <= d - k2End; k2 += 2) {
+			int k2Off = vOff + k2;
+			int x2 = k2 == -d || (k2 != d && r->v2[k2Off - 1] < r->v2[k2Off + 1]) ? r->v2[k2Off + 1] : r->v2[k2Off - 1] + 1;
+			int y2 = x2 - k2;
+
+			while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+				x2++;
+				y2++;
+			}
+			r->v2[k2Off] = x2;
+
+			if (x2 > n) {
+				k2End += 2;
+			} else if (y2 > m) {
+				k2Start += 2;
+			} else if (!front) {
+				int k1Off = vOff + delta - k2;
+				if (k1Off >= 0 && k1Off < vLen && r->v1[k1Off] != -1 && r->v1[k1Off] >= n - x2) {
+					*x = r->v1[k1Off];
+					*y = vOff + *x - k1Off;
+					return 0;
+				}
+			}
+		}
+	}
+
+	return -1;
+}
+
+// Matches the common lines of a[a0..a1) and b[b0..b1), lines of a left unmatched keep -1
+void editor_diff_compare(struct DiffRun* r, int a0, int a1, int b0, int b1) {
+	while (a0 < a1 && b0 < b1 && r->a[a0] == r->b[b0]) {
+		r->match[a0++] = r->off + b0++;
+	}
+	while (a0 < a1 && b0 < b1 && r->a[a1 - 1] == r->b[b1 - 1]) {
+		r->match[--a1] = r->off + --b1;
+	}
+
+	int x, y;
+	if (a0 == a1 || b0 == b1 || editor_diff_bisect(r, a0, a1, b0, b1, &x, &y) == -1) {
+		return;
+	}
+
+	editor_diff_compare(r, a0, a0 + x, b0, b0 + y);
+	editor_diff_compare(r, a0 + x, a1, b0 + y, b1);
+}
+
+// Diffs rows p + 1 to q - 1 of buf against the disk lines between the ones rows p and q are matched with
+void editor_diff_gap(struct EditorBuffer* buf, int p, int q) {
+	struct DiffState* d = buf->diff;
+	int dp = p >= 0 ? d->match[p] : -1;
+	int dq = q < buf->numRows ? d->match[q] : d->diskRows;
+	int n = q - p - 1;
+	int m = dq - dp - 1;
+
+	for (int i = p + 1; i < q; i++) {
+		d->match[i] = -1;
+	}
+	if (n == 0 || m == 0) {
+		return;
+	}
+
+	uint64_t* a = malloc(sizeof(uint64_t) * n);
+	int* v = malloc(sizeof(int) * 2 * (n + m + 4));
+	if (a == NULL || v == NULL) {
+		die("editor_diff_gap()::malloc()");
+	}
+
+	for (int i = 0; i < n; i++) {
+		a[i] = editor_row_hash(buf, p + 1 + i);
+	}
+
+	struct DiffRun r = { a, d->disk + dp + 1, d->match + p + 1, dp + 1, v, v + n + m + 4 };
+	editor_diff_compare(&r, 0, n, 0, m);
+
+	free(v);
+	free(a);
+}
+
+/* Diffs the gaps around the rows edited since the last update of buf and marks them again
+ * Returns 1 if anything was to be done
+ */
+int editor_diff_update(struct EditorBuffer* buf) {
+	struct DiffState* d = buf->diff;
+	if (d == NULL || !d->dirty) {
+		return 0;
+	}
+
+	// The matched rows around the edits are kept as anchors
+	int a = d->dirtyLo - 1;
+	while (a >= 0 && d->match[a] < 0) {
+		a--;
+	}
+	int b = d->dirtyHi;
+	while (b < buf->numRows && d->match[b] < 0) {
+		b++;
+	}
+
+	// Gaps between the matched rows are diffed again
+	for (int p = a; p < b;) {
+		int q = p + 1;
+		while (q < b && d->match[q] < 0) {
+			q++;
+		}
+
+		int dp = p >= 0 ? d->match[p] : -1;
+		int dq = q < buf->numRows ? d->match[q] : d->diskRows;
+		if (q - p > 1 || dq - dp > 1) {
+			editor_diff_gap(buf, p, q);
+		}
+
+		p = q;
+	}
+
+	// Then marked, the first rows of a gap replace its disk lines and the others are new
+	for (int p = a; p < b;) {
+		int q = p + 1;
+		while (q < b && d->match[q] < 0) {
+			q++;
+		}
+
+		int rows = q - p - 1;
+		int lines = (q < buf->numRows ? d->match[q] : d->diskRows) - (p >= 0 ? d->match[p] : -1) - 1;
+		for (int i = 0; i < rows; i++) {
+			d->mark[p + 1 + i] = i < lines ? DIFF_CHANGED : DIFF_ADDED;
+		}
+		d->mark[q] = rows == 0 && lines > 0 ? DIFF_REMOVED : DIFF_SAME;
+
+		p = q;
+	}
+
+	d->dirty = 0;
+	return 1;
+}
+
+// Updates the diffs of every buffer once typing pauses, returns 1 if the screen should be redrawn
+int editor_diff_tick(void) {
+	int changed = 0;
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		changed |= editor_diff_update(ec.bufs[i]);
+	}
+
+	return changed;
+}
+
+void editor_diff_dirty(struct DiffState* d, int lo, int hi) {
+	if (!d->dirty) {
+		d->dirty = 1;
+		d->dirtyLo = lo;
+		d->dirtyHi = hi;
+		return;
+	}
+
+	d->dirtyLo = lo < d->dirtyLo ? lo : d->dirtyLo;
+	d->dirtyHi = hi > d->dirtyHi ? hi : d->dirtyHi;
+}
+
+// Notes that the chars of row at of buf changed
+void editor_diff_touch(struct EditorBuffer* buf, int at) {
+	struct DiffState* d = buf->diff;
+	if (d == NULL || at < 0 || at >= buf->numRows) {
+		return;
+	}
+
+	d->match[at] = -1;
+	if (d->mark[at] == DIFF_SAME || d->mark[at] == DIFF_REMOVED) {
+		d->mark[at] = DIFF_CHANGED;
+	}
+	editor_diff_dirty(d, at, at + 1);
+}
+
+// Notes that delta rows were inserted at index at of buf, or -delta rows removed from there
+void editor_diff_move(struct EditorBuffer* buf, int at, int delta) {
+	struct DiffState* d = buf->diff;
+	if (d == NULL) {
+		return;
+	}
+
+	// Both arrays have one more entry, for lines removed after the last row
+	int n = buf->numRows + 1;
+
+	if (delta > 0) {
+		if (n + delta > d->cap) {
+			d->cap = (n + delta) * 2;
+			d->match = realloc(d->match, sizeof(int) * d->cap);
+			d->mark = realloc(d->mark, d->cap);
+		}
+
+		memmove(&d->match[at + delta], &d->match[at], sizeof(int) * (n - at));
+		memmove(&d->mark[at + delta], &d->mark[at], n - at);
+		for (int i = at; i < at + delta; i++) {
+			d->match[i] = -1;
+			d->mark[i] = DIFF_ADDED;
+		}
+
+		if (d->dirty) {
+			d->dirtyLo += d->dirtyLo >= at ? delta : 0;
+			d->dirtyHi += d->dirtyHi > at ? delta : 0;
+		}
+		editor_diff_dirty(d, at, at + delta);
+	} else {
+		memmove(&d->match[at], &d->match[at - delta], sizeof(int) * (n - at + delta));
+		memmove(&d->mark[at], &d->mark[at - delta], n - at + delta);
+
+		if (d->dirty) {
+			d->dirtyLo = d->dirtyLo >= at - delta ? d->dirtyLo + delta : d->dirtyLo > at ? at : d->dirtyLo;
+			d->dirtyHi = d->dirtyHi >= at - delta ? d->dirtyHi + delta : d->dirtyHi > at ? at : d->dirtyHi;
+		}
+		editor_diff_dirty(d, at, at);
+	}
+}
+
+// Notes the rows of buf whose hash an edit cleared, after changes made outside the row operations
+void editor_diff_touch_changed(struct EditorBuffer* buf) {
+	if (buf->diff == NULL) {
+		return;
+	}
+
+	for (int j = 0; j < buf->numRows; j++) {
+		if (buf->row[j].hash == 0) {
+			editor_diff_touch(buf, j);
+		}
+	}
+}
+
+/* Reads the hashes of the lines of the file of buf into *hashes, lines are split like editor_open() does
+ * Returns their number or -1 with errno set
+ */
+int editor_diff_read_disk(struct EditorBuffer* buf, uint64_t** hashes) {
+	int fd = open(buf->filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return -1;
+	}
+
+	int n = 0;
+	*hashes = NULL;
+
+	if (buf->compressed) {
+		struct EditorRow* rows;
+		n = gzip_read_rows(fd, &rows);
+		close(fd);
+		if (n == -1) {
+			return -1;
+		}
+
+		*hashes = malloc(sizeof(uint64_t) * (n ? n : 1));
+		for (int i = 0; i < n; i++) {
+			(*hashes)[i] = editor_hash_bytes(rows[i].chars, rows[i].size);
+			free(rows[i].chars);
+		}
+		free(rows);
+		return n;
+	}
+
+	FILE* fp = fdopen(fd, "r");
+	char* line = NULL;
+	size_t lineCap = 0;
+	ssize_t lineLen;
+	int cap = 0;
+
+	while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
+		while (lineLen > 0 && (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\r')) {
+			lineLen--;
+		}
+
+		if (n == cap) {
+			cap = cap ? cap * 2 : 1024;
+			*hashes = realloc(*hashes, sizeof(uint64_t) * cap);
+		}
+		(*hashes)[n++] = editor_hash_bytes(line, lineLen);
+	}
+
+	free(line);
+	fclose(fp);
+	return n;
+}
+
+// The file of buf now holds its rows, nothing differs any more
+void editor_diff_saved(struct EditorBuffer* buf) {
+	struct DiffState* d = buf->diff;
+	if (d == NULL) {
+		return;
+	}
+
+	if (buf->numRows + 1 > d->cap) {
+		d->cap = buf->numRows + 1;
+		d->match = realloc(d->match, sizeof(int) * d->cap);
+		d->mark = realloc(d->mark, d->cap);
+	}
+
+	d->disk = realloc(d->disk, sizeof(uint64_t) * (buf->numRows ? buf->numRows : 1));
+	d->diskRows = buf->numRows;
+
+	for (int j = 0; j < buf->numRows; j++) {
+		d->disk[j] = editor_row_hash(buf, j);
+		d->match[j] = j;
+	}
+	memset(d->mark, DIFF_SAME, buf->numRows + 1);
+	d->dirty = 0;
+}
+
+void editor_diff_free(struct EditorBuffer* buf) {
+	free(buf->diff->disk);
+	free(buf->diff->match);
+	free(buf->diff->mark);
+	free(buf->diff);
+	buf->diff = NULL;
+}
+
+// Shows or hides the differences between the active buffer and its file
+void editor_diff_toggle(void) {
+	struct EditorBuffer* buf = ec.buf;
+
+	if (buf->diff) {
+		editor_diff_free(buf);
+		editor_set_status_message("Diff hidden");
+		return;
+	}
+
+	if (buf->view || buf->filename == NULL) {
+		editor_set_status_message("Only a buffer of a file can be diffed");
+		return;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	uint64_t* disk;
+	int diskRows = editor_diff_read_disk(buf, &disk);
+	if (diskRows == -1) {
+		editor_set_status_message("%s: can't read: %s", buf->filename, strerror(errno));
+		return;
+	}
+
+	struct DiffState* d = calloc(1, sizeof(struct DiffState));
+	if (d == NULL) {
+		die("editor_diff_toggle()::calloc()");
+	}
+
+	d->disk = disk;
+	d->diskRows = diskRows;
+	d->cap = buf->numRows + 1;
+	d->match = malloc(sizeof(int) * d->cap);
+	d->mark = malloc(d->cap);
+	for (int j = 0; j < d->cap; j++) {
+		d->match[j] = -1;
+	}
+	memset(d->mark, DIFF_SAME, d->cap);
+	buf->diff = d;
+
+	editor_diff_dirty(d, 0, buf->numRows);
+	editor_diff_update(buf);
+
+	int marked = 0;
+	for (int j = 0; j <= buf->numRows; j++) {
+		marked += d->mark[j] != DIFF_SAME;
+	}
+
+	editor_set_status_message("Diff with %s: %d row(s) marked in %.1f ms", buf->filename, marked, editor_bench_ms(&start));
+}
+
+/***** STATISTICS *****/
+
+/* The status bar shows the bytes, words and characters of a buffer and the byte offset of the cursor
+ * Rows are counted once when inserted and again after their chars change, the totals only move by the difference.
+ * Offsets come from a Fenwick tree of the bytes of each row, inserting or removing rows invalidates the nodes past them
+ */
+
+// Counts the chars of row and adds them to the totals of st, or takes them out with sign -1
+void editor_stats_add(struct RowStats* st, struct EditorRow* row, int sign) {
+	if (sign > 0) {
+		row->countedSize = row->size;
+		row->countedChars = utf8_count(row->chars, row->size, &row->countedWords);
+	}
+
+	st->bytes += sign * (row->countedSize + 1);
+	st->words += sign * row->countedWords;
+	st->chars += sign * (row->countedChars + 1);
+}
+
+// Notes that the chars of rows from at to to - 1 of buf changed, they are counted again by editor_stats_sync()
+void editor_stats_touch(struct EditorBuffer* buf, int at, int to) {
+	struct RowStats* st = &buf->share->stats;
+	if (at >= to) {
+		return;
+	}
+
+	if (!st->dirty) {
+		st->dirty = 1;
+		st->dirtyLo = at;
+		st->dirtyHi = to;
+		return;
+	}
+
+	st->dirtyLo = at < st->dirtyLo ? at : st->dirtyLo;
+	st->dirtyHi = to > st->dirtyHi ? to : st->dirtyHi;
+}
+
+// Counts the n rows just inserted at index at of buf
+void editor_stats_insert(struct EditorBuffer* buf, int at, int n) {
+	struct RowStats* st = &buf->share->stats;
+
+	for (int j = at; j < at + n; j++) {
+		editor_stats_add(st, &buf->row[j], 1);
+	}
+
+	if (st->dirty) {
+		st->dirtyLo += st->dirtyLo >= at ? n : 0;
+		st->dirtyHi += st->dirtyHi > at ? n : 0;
+	}
+	if (st->treeValid > at) {
+		st->treeValid = at;
+	}
+}
+
+// Takes the n rows at index at of buf, which are about to be removed, out of the totals
+void editor_stats_remove(struct EditorBuffer* buf, int at, int n) {
+	struct RowStats* st = &buf->share->stats;
+
+	for (int j = at; j < at + n; j++) {
+		editor_stats_add(st, &buf->row[j], -1);
+	}
+
+	if (st->dirty) {
+		st->dirtyLo = st->dirtyLo >= at + n ? st->dirtyLo - n : st->dirtyLo > at ? at : st->dirtyLo;
+		st->dirtyHi = st->dirtyHi >= at + n ? st->dirtyHi - n : st->dirtyHi > at ? at : st->dirtyHi;
+		st->dirty = st->dirtyLo < st->dirtyHi;
+	}
+	if (st->treeValid > at) {
+		st->treeValid = at;
+	}
+}
+
+// Brings the totals and the tree of buf up to date, only the touched rows are counted again
+void editor_stats_sync(struct EditorBuffer* buf) {
+	struct RowStats* st = &buf->share->stats;
+	if (buf->view) {
+		return;
+	}
+
+	if (st->dirty) {
+		int to = st->dirtyHi < buf->numRows ? st->dirtyHi : buf->numRows;
+
+		for (int j = st->dirtyLo; j < to; j++) {
+			struct EditorRow* row = editor_buffer_row(buf, j);
+			long long delta = row->size - row->countedSize;
+
+			editor_stats_add(st, row, -1);
+			editor_stats_add(st, row, 1);
+
+			// Nodes past treeValid are rebuilt anyway
+			for (int k = j + 1; k <= st->treeValid; k += k & -k) {
+				st->tree[k] += delta;
+			}
+		}
+
+		st->dirty = 0;
+	}
+
+	if (st->treeValid == buf->numRows) {
+		return;
+	}
+
+	if (buf->numRows + 1 > st->treeCap) {
+		st->treeCap = (buf->numRows + 1) * 2;
+		st->tree = realloc(st->tree, sizeof(long long) * st->treeCap);
+		if (st->tree == NULL) {
+			die("editor_stats_sync()::realloc()");
+		}
+	}
+
+	/* Rebuilds the nodes past treeValid in linear time: each node starts with its own row,
+	 * then hands its sum to its parent. The valid nodes with a parent past treeValid are
+	 * the ones a prefix sum up to treeValid visits
+	 */
+	int n = buf->numRows;
+	int valid = st->treeValid;
+
+	for (int k = valid + 1; k <= n; k++) {
+		st->tree[k] = buf->row[k - 1].countedSize + 1;
+	}
+	for (int k = valid; k > 0; k -= k & -k) {
+		if (k + (k & -k) <= n) {
+			st->tree[k + (k & -k)] += st->tree[k];
+		}
+	}
+	for (int k = valid + 1; k <= n; k++) {
+		if (k + (k & -k) <= n) {
+			st->tree[k + (k & -k)] += st->tree[k];
+		}
+	}
+
+	st->treeValid = n;
+}
+
+// Returns the byte offset of the start of row at of buf in the file it would be saved to
+long long editor_stats_offset(struct EditorBuffer* buf, int at) {
+	struct RowStats* st = &buf->share->stats;
+	editor_stats_sync(buf);
+
+	long long offset = 0;
+	for (int k = at; k > 0; k -= k & -k) {
+		offset += st->tree[k];
+	}
+
+	return offset;
+}
+
+/***** COMPLETION *****/
+
+/* Ctrl-n completes the identifier before the cursor with the ones found in the open rows, pressed again
+ * it moves to the next one and Ctrl-p to the previous one. Occurrences are counted in a hash table and
+ * the identifiers that have some are kept in a trie for the prefix lookups. A row adds its identifiers
+ * when editor_update_row() sees it unindexed and takes them back before its chars change, so an edit
+ * costs the length of one row. Rows loaded in bulk are indexed in slices while keys are awaited
+ */
+
+struct CompleteNode {
+	int child; // First child, children are sorted by c
+	int next; // Next sibling, or next free node once reclaimed
+	int count; // 1 if the identifier ending here occurs, 0 otherwise
+	int total; // Identifiers occurring below, a node other than the root is reclaimed when it drops to 0
+	char c;
+};
+
+// Entry of the occurrence table, freed when its count drops to 0
+struct CompleteWord {
+	uint64_t hash; // 0 for free entries
+	char* word;
+	int len;
+	int count;
+};
+
+struct CompleteIndex {
+	struct CompleteNode* nodes; // nodes[0] is the root, created with the first identifier
+	int numNodes;
+	int capNodes;
+	int freeNodes; // First reclaimed node, linked by next, 0 if there is none as the root is never reclaimed
+
+	struct CompleteWord* table; // Open addressing, at most half full
+	int capTable;
+	int numTable;
+	long long words; // Occurrences indexed
+
+	// The completion going on, pick -1 stands for the prefix alone
+	struct EditorBuffer* buf;
+	int cy;
+	int cx; // End of the prefix
+	int inserted; // Bytes of found[pick] inserted after the prefix
+	int prefixLen;
+	int numFound;
+	int pick;
+	char found[EDITOR_COMPLETE_MAX][EDITOR_COMPLETE_MAX_WORD + 1];
+} comp;
+
+int editor_complete_is_ident(int c) {
+	return c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Takes a node for c followed by the sibling next from the reclaimed ones or appends it, returns its index
+int editor_complete_new_node(char c, int next) {
+	int k = comp.freeNodes;
+	if (k) {
+		comp.freeNodes = comp.nodes[k].next;
+	} else {
+		if (comp.numNodes == comp.capNodes) {
+			comp.capNodes = comp.capNodes ? comp.capNodes * 2 : 4096;
+			comp.nodes = realloc(comp.nodes, sizeof(struct CompleteNode) * comp.capNodes);
+			if (comp.nodes == NULL) {
+				die("editor_complete_new_node()::realloc()");
+			}
+		}
+
+		k = comp.numNodes++;
+	}
+
+	comp.nodes[k].child = -1;
+	comp.nodes[k].next = next;
+	comp.nodes[k].count = 0;
+	comp.nodes[k].total = 0;
+	comp.nodes[k].c = c;
+
+	return k;
+}
+
+// Returns the child of node holding c, a new one is linked in its sorted place when create is set, -1 otherwise
+int editor_complete_child(int node, char c, int create) {
+	int prev = -1;
+	int k = comp.nodes[node].child;
+
+	while (k != -1 && comp.nodes[k].c < c) {
+		prev = k;
+		k = comp.nodes[k].next;
+	}
+	if (k != -1 && comp.nodes[k].c == c) {
+		return k;
+	}
+	if (!create) {
+		return -1;
+	}
+
+	int added = editor_complete_new_node(c, k);
+	if (prev == -1) {
+		comp.nodes[node].child = added;
+	} else {
+		comp.nodes[prev].next = added;
+	}
+
+	return added;
+}
+
+// Puts node and the nodes below it on the free list
+void editor_complete_free_node(int node) {
+	for (int k = comp.nodes[node].child; k != -1;) {
+		int next = comp.nodes[k].next;
+		editor_complete_free_node(k);
+		k = next;
+	}
+
+	comp.nodes[node].next = comp.freeNodes;
+	comp.freeNodes = node;
+}
+
+// Adds the len bytes of word to the trie with delta 1, or takes them out with -1
+void editor_complete_trie_add(const char* word, int len, int delta) {
+	if (comp.numNodes == 0) {
+		editor_complete_new_node(0, -1);
+	}
+
+	int node = 0;
+	comp.nodes[0].total += delta;
+
+	for (int j = 0; j < len; j++) {
+		int parent = node;
+		node = editor_complete_child(node, word[j], delta > 0);
+		comp.nodes[node].total += delta;
+
+		// Below there is only what held word, unlinked and reclaimed at once
+		if (comp.nodes[node].total == 0) {
+			int* link = &comp.nodes[parent].child;
+			while (*link != node) {
+				link = &comp.nodes[*link].next;
+			}
+			*link = comp.nodes[node].next;
+
+			editor_complete_free_node(node);
+			return;
+		}
+	}
+
+	comp.nodes[node].count += delta;
+}
+
+// Returns the entry of the occurrence table for the len bytes of word, a free one if it was never seen
+struct CompleteWord* editor_complete_entry(const char* word, int len, uint64_t hash) {
+	int mask = comp.capTable - 1;
+
+	for (int k = hash & mask;; k = (k + 1) & mask) {
+		struct CompleteWord* e = &comp.table[k];
+
+		if (e->hash == 0 || (e->hash == hash && e->len == len && memcmp(e->word, word, len) == 0)) {
+			return e;
+		}
+	}
+}
+
+// Frees entry e of the occurrence table, the entries after it move back so that probes still find them
+void editor_complete_drop(struct CompleteWord* e) {
+	int mask = comp.capTable - 1;
+	int hole = e - comp.table;
+
+	free(e->word);
+	for (int k = (hole + 1) & mask; comp.table[k].hash; k = (k + 1) & mask) {
+		// An entry may fill the hole unless its probe starts after the hole, up to k
+		int home = comp.table[k].hash & mask;
+		if (hole <= k ? home <= hole || home > k : home <= hole && home > k) {
+			comp.table[hole] = comp.table[k];
+			hole = k;
+		}
+	}
+
+	comp.table[hole].hash = 0;
+	comp.table[hole].word = NULL;
+	comp.numTable--;
+}
+
+/* Adds delta occurrences of the len bytes of word
+ * The trie only changes when the identifier appears or disappears, most occurrences are one table probe
+ */
+void editor_complete_add(const char* word, int len, int delta) {
+	if (comp.numTable * 2 >= comp.capTable) {
+		struct CompleteWord* old = comp.table;
+		int oldCap = comp.capTable;
+
+		comp.capTable = oldCap ? oldCap * 2 : 4096;
+		comp.table = calloc(comp.capTable, sizeof(struct CompleteWord));
+		if (comp.table == NULL) {
+			die("editor_complete_add()::calloc()");
+		}
+
+		for (int k = 0; k < oldCap; k++) {
+			if (old[k].hash) {
+				*editor_complete_entry(old[k].word, old[k].len, old[k].hash) = old[k];
+			}
+		}
+		free(old);
+	}
+
+	uint64_t hash = editor_hash_bytes(word, len);
+	struct CompleteWord* e = editor_complete_entry(word, len, hash);
+
+	if (e->hash == 0) {
+		if (delta < 0) {
+			return;
+		}
+
+		e->hash = hash;
+		e->word = malloc(len);
+		if (e->word == NULL) {
+			die("editor_complete_add()::malloc()");
+		}
+		memcpy(e->word, word, len);
+		e->len = len;
+		e->count = 0;
+		comp.numTable++;
+	}
+
+	if (e->count == 0 && delta > 0) {
+		editor_complete_trie_add(word, len, 1);
+	} else if (e->count > 0 && e->count + delta <= 0) {
+		editor_complete_trie_add(word, len, -1);
+	}
+
+	int before = e->count;
+	e->count = before + delta > 0 ? before + delta : 0;
+	comp.words += e->count - before;
+
+	if (e->count == 0) {
+		editor_complete_drop(e);
+	}
+}
+
+// Adds delta occurrences of every identifier in the len bytes of s, those starting with a digit are numbers
+void editor_complete_words(const char* s, int len, int delta) {
+	int j = 0;
+
+	while (j < len) {
+		if (!editor_complete_is_ident((unsigned char) s[j])) {
+			j++;
+			continue;
+		}
+
+		int from = j;
+		while (j < len && editor_complete_is_ident((unsigned char) s[j])) {
+			j++;
+		}
+
+		int n = j - from;
+		if (!(s[from] >= '0' && s[from] <= '9') && n >= EDITOR_COMPLETE_MIN_WORD && n <= EDITOR_COMPLETE_MAX_WORD) {
+			editor_complete_add(&s[from], n, delta);
+		}
+	}
+}
+
+void editor_complete_learn(struct EditorRow* row) {
+	if (row->indexed != 0 || row->chars == NULL) {
+		return;
+	}
+
+	editor_complete_words(row->chars, row->size, 1);
+	row->indexed = 1;
+}
+
+// Takes the identifiers of row out of the index, before its chars change or it goes away
+void editor_complete_forget(struct EditorRow* row) {
+	if (row->indexed != 1 || row->chars == NULL) {
+		return;
+	}
+
+	editor_complete_words(row->chars, row->size, -1);
+	row->indexed = 0;
+}
+
+// Indexes row again after its chars were replaced behind the index's back, old holds the ones it had
+void editor_complete_relearn(struct EditorRow* row, const char* old, int oldSize) {
+	editor_complete_words(old, oldSize, -1);
+	row->indexed = 0;
+	editor_complete_learn(row);
+}
+
+// Notes that n rows were inserted at index at of buf, the ones not indexed yet are left to editor_complete_tick()
+void editor_complete_insert(struct EditorBuffer* buf, int at, int n) {
+	for (int j = at; j < at + n; j++) {
+		if (buf->row[j].indexed == 0) {
+			if (buf->share->indexFrom > j) {
+				buf->share->indexFrom = j;
+			}
+			return;
+		}
+	}
+}
+
+// Takes the n rows at index at of buf, which are about to be removed, out of the index
+void editor_complete_remove(struct EditorBuffer* buf, int at, int n) {
+	for (int j = at; j < at + n; j++) {
+		editor_complete_forget(&buf->row[j]);
+	}
+
+	int* from = &buf->share->indexFrom;
+	*from = *from >= at + n ? *from - n : *from > at ? at : *from;
+}
+
+/* Indexes the rows of every buffer that are not yet, for at most EDITOR_COMPLETE_SLICE ms
+ * Called while keys are awaited, the rows of a big file get indexed over a few pauses
+ */
+void editor_complete_tick(void) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (int i = 0; i < ec.numBufs; i++) {
+		struct EditorBuffer* buf = ec.bufs[i];
+		struct RowShare* share = buf->share;
+		if (buf->view) {
+			continue;
+		}
+
+		while (share->indexFrom < buf->numRows) {
+			int to = share->indexFrom + 1024 < buf->numRows ? share->indexFrom + 1024 : buf->numRows;
+
+			for (int j = share->indexFrom; j < to; j++) {
+				editor_complete_learn(&buf->row[j]);
+			}
+			share->indexFrom = to;
+
+			if (editor_bench_ms(&start) > EDITOR_COMPLETE_SLICE) {
+				return;
+			}
+		}
+	}
+}
+
+// Appends the identifiers below node, whose first len bytes are in word, to comp.found depth first in byte order
+void editor_complete_collect(int node, char* word, int len) {
+	for (int k = comp.nodes[node].child; k != -1 && comp.numFound < EDITOR_COMPLETE_MAX; k = comp.nodes[k].next) {
+		word[len] = comp.nodes[k].c;
+		if (comp.nodes[k].count > 0) {
+			memcpy(comp.found[comp.numFound], word, len + 1);
+			comp.found[comp.numFound][len + 1] = '\0';
+			comp.numFound++;
+		}
+
+		editor_complete_collect(k, word, len + 1);
+	}
+}
+
+/* Fills comp.found with the first EDITOR_COMPLETE_MAX identifiers starting with the len bytes of prefix, in byte order
+ * so an identifier comes right before the longer ones it begins. Branches left empty are reclaimed,
+ * so the cost depends on the prefix and the results, not on the index size
+ */
+void editor_complete_lookup(const char* prefix, int len) {
+	comp.numFound = 0;
+
+	int node = comp.numNodes ? 0 : -1;
+	for (int j = 0; j < len && node != -1; j++) {
+		node = editor_complete_child(node, prefix[j], 0);
+	}
+	if (node == -1 || len > EDITOR_COMPLETE_MAX_WORD) {
+		return;
+	}
+
+	char word[EDITOR_COMPLETE_MAX_WORD + 1];
+	memcpy(word, prefix, len);
+	editor_complete_collect(node, word, len);
+}
+
+// Moves the completion of the active buffer step candidates forward, or starts it on the identifier before the cursor
+void editor_complete(int step) {
+	struct EditorBuffer* buf = ec.buf;
+	if (buf->cury >= buf->numRows) {
+		return;
+	}
+
+	struct EditorRow* row = editor_buffer_row(buf, buf->cury);
+
+	if (comp.buf != buf || comp.cy != buf->cury || comp.cx + comp.inserted != buf->curx || comp.cx > row->size) {
+		int from = buf->curx;
+		while (from > 0 && editor_complete_is_ident((unsigned char) row->chars[from - 1])) {
+			from--;
+		}
+		if (from == buf->curx) {
+			editor_set_status_message("Nothing to complete before the cursor");
+			comp.buf = NULL;
+			return;
+		}
+
+		// The identifier the cursor is in counts once in the index, it isn't a completion of itself
+		int to = buf->curx;
+		while (to < row->size && editor_complete_is_ident((unsigned char) row->chars[to])) {
+			to++;
+		}
+		if (row->indexed == 1) {
+			editor_complete_words(&row->chars[from], to - from, -1);
+		}
+		editor_complete_lookup(&row->chars[from], buf->curx - from);
+		if (row->indexed == 1) {
+			editor_complete_words(&row->chars[from], to - from, 1);
+		}
+
+		if (comp.numFound == 0) {
+			editor_set_status_message("No completion for %.*s", buf->curx - from, &row->chars[from]);
+			comp.buf = NULL;
+			return;
+		}
+
+		comp.buf = buf;
+		comp.cy = buf->cury;
+		comp.cx = buf->curx;
+		comp.prefixLen = buf->curx - from;
+		comp.inserted = 0;
+		comp.pick = -1;
+	}
+
+	// The prefix alone sits between the last candidate and the first one
+	comp.pick = (comp.pick + 1 + step + comp.numFound + 1) % (comp.numFound + 1) - 1;
+
+	editor_buffer_unshare(buf);
+	row = editor_buffer_row(buf, buf->cury);
+
+	// The previous candidate makes way for the next one in a single splice
+	char* rest = comp.pick >= 0 ? comp.found[comp.pick] + comp.prefixLen : "";
+	int restLen = strlen(rest);
+	if (comp.inserted > 0 || restLen > 0) {
+		editor_row_splice(row, comp.cx, comp.inserted, rest, restLen);
+	}
+	comp.inserted = restLen;
+
+	if (comp.pick >= 0) {
+		editor_set_status_message("Completion %d of %d%s", comp.pick + 1, comp.numFound, comp.numFound == EDITOR_COMPLETE_MAX ? "+" : "");
+	} else {
+		editor_set_status_message("Back to the original");
+	}
+
+	buf->curx = comp.cx + comp.inserted;
+}
+
+/* Loads filename, indexes it like the idle ticks would, then looks up the first bytes of identifiers
+ * taken from random rows and prints how long a lookup takes
+ */
+int editor_bench_complete(char* filename) {
+	if (editor_open(filename) == -1) {
+		perror(filename);
+		return 1;
+	}
+	if (ec.buf->view) {
+		fprintf(stderr, "%s: too big to be held in memory\n", filename);
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (ec.buf->share->indexFrom < ec.buf->numRows) {
+		editor_complete_tick();
+	}
+	double indexMs = editor_bench_ms(&start);
+
+	printf("indexed %lld identifiers of %d rows in %.1f ms, %d trie nodes\n", comp.words, ec.buf->numRows, indexMs, comp.numNodes);
+
+	int lookups = 0;
+	double total = 0;
+	double worst = 0;
+	srand(1);
+
+	for (int i = 0; i < 10000 && ec.buf->numRows > 0; i++) {
+		struct EditorRow* row = &ec.buf->row[rand() % ec.buf->numRows];
+		int at = row->size ? rand() % row->size : 0;
+
+		while (at < row->size && !editor_complete_is_ident((unsigned char) row->chars[at])) {
+			at++;
+		}
+		if (at == row->size) {
+			continue;
+		}
+
+		int len = 1 + rand() % 3;
+		if (len > row->size - at) {
+			len = row->size - at;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		editor_complete_lookup(&row->chars[at], len);
+		double ms = editor_bench_ms(&start);
+
+		lookups++;
+		total += ms;
+		worst = ms > worst ? ms : worst;
+	}
+
+	printf("%d lookups: %.4f ms on average, %.4f ms at worst\n", lookups, lookups ? total / lookups : 0.0, worst);
+
+	return 0;
+}
+
+/***** CURSORS *****/
+
+/* Ctrl-a adds a cursor at every match of a literal, next to the ones the buffer already has. A key typed
+ * then is applied at all of them at once: the edits falling on one row are made in a single new copy of
+ * its chars, journaled as one splice and rendered once, so K cursors on a row cost one rebuild of it.
+ * Characters, Backspace and Delete within a row and the moves are applied everywhere, any other key
+ * drops the extra cursors before it does its usual thing, Esc too
+ */
+
+int editor_cursor_cmp(const void* a, const void* b) {
+	const struct EditorCursor* p = a;
+	const struct EditorCursor* q = b;
+
+	if (p->y != q->y) {
+		return p->y < q->y ? -1 : 1;
+	}
+
+	return (p->x > q->x) - (p->x < q->x);
+}
+
+void editor_cursors_clear(struct EditorBuffer* buf) {
+	free(buf->cursors);
+	buf->cursors = NULL;
+	buf->numCursors = 0;
+	buf->capCursors = 0;
+}
+
+// Sorts the extra cursors of buf when asked, then drops the duplicates and the one on curx / cury
+void editor_cursors_tidy(struct EditorBuffer* buf, int sort) {
+	if (sort) {
+		qsort(buf->cursors, buf->numCursors, sizeof(struct EditorCursor), editor_cursor_cmp);
+	}
+
+	int n = 0;
+	for (int i = 0; i < buf->numCursors; i++) {
+		struct EditorCursor* c = &buf->cursors[i];
+
+		if (c->x == buf->curx && c->y == buf->cury) {
+			continue;
+		}
+		if (n > 0 && c->x == buf->cursors[n - 1].x && c->y == buf->cursors[n - 1].y) {
+			continue;
+		}
+
+		buf->cursors[n++] = *c;
+	}
+
+	buf->numCursors = n;
+}
+
+/* Adds a cursor at the start of every match of the len bytes of s in buf, returns the number of matches
+ * Matches don't overlap, like the ones replaced by editor_replace_all()
+ */
+int editor_cursors_add_matches(struct EditorBuffer* buf, const char* s, size_t len) {
+	struct ColdReader reader = {.buf = buf};
+
+	int found = 0;
+	for (int y = 0; y < buf->numRows; y++) {
+		// Packed rows are searched without being unpacked, the row operations do it if they get edited
+		struct EditorRow row = {.size = buf->row[y].size, .chars = editor_cold_peek(&reader, y)};
+		size_t pos = 0;
+
+		while (pos + len <= (size_t) row.size) {
+			char* hit = memmem(&row.chars[pos], row.size - pos, s, len);
+			if (hit == NULL) {
+				break;
+			}
+
+			if (buf->numCursors == buf->capCursors) {
+				buf->capCursors = buf->capCursors ? buf->capCursors * 2 : 64;
+				buf->cursors = realloc(buf->cursors, sizeof(struct EditorCursor) * buf->capCursors);
+				if (buf->cursors == NULL) {
+					die("editor_cursors_add_matches()::realloc()");
+				}
+			}
+
+			int x = hit - row.chars;
+			buf->cursors[buf->numCursors].x = editor_row_char_start(&row, x);
+			buf->cursors[buf->numCursors].y = y;
+			buf->numCursors++;
+			found++;
+
+			pos = x + len;
+		}
+	}
+
+	free(reader.raw);
+	editor_cursors_tidy(buf, 1);
+
+	return found;
+}
+
+// Adds cursors at the matches of a literal typed at the prompt
+void editor_cursors_add(void) {
+	char* query = editor_prompt("Add cursors at: %s (ESC to cancel)", NULL);
+	if (query == NULL) {
+		return;
+	}
+
+	int found = editor_cursors_add_matches(ec.buf, query, strlen(query));
+	if (found) {
+		editor_set_status_message("%d matches, %d cursors (ESC to drop them)", found, ec.buf->numCursors + 1);
+	} else {
+		editor_set_status_message("No match for %s", query);
+	}
+
+	free(query);
+}
+
+// Returns in *from and *to the bytes of row that key removes from the cursor at x, none for a character
+void editor_cursors_span(struct EditorRow* row, int x, int key, int* from, int* to) {
+	*from = x;
+	*to = x;
+
+	if (key == DEL && x < row->size) {
+		*to = editor_row_next_char(row, x);
+	} else if ((key == BACKSPACE || key == CTRL_KEY('h')) && x > 0) {
+		*from = editor_row_prev_char(row, x);
+	}
+}
+
+// Applies key, a character to insert or a deletion within the row, at every cursor of the active buffer
+void editor_cursors_edit(int key) {
+	struct EditorBuffer* buf = ec.buf;
+	int insert = key != DEL && key != BACKSPACE && key != CTRL_KEY('h');
+	char ch = key;
+
+	editor_buffer_unshare(buf);
+
+	if (insert && buf->cury == buf->numRows) {
+		editor_insert_row(buf->numRows, "", 0);
+	}
+
+	// The cursor of the buffer takes its sorted place among the extra ones
+	struct EditorCursor own = {buf->curx, buf->cury};
+	int lo = 0;
+	int hi = buf->numCursors;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (editor_cursor_cmp(&buf->cursors[mid], &own) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	int n = buf->numCursors + 1;
+	struct EditorCursor* all = malloc(sizeof(struct EditorCursor) * n);
+	if (all == NULL) {
+		die("editor_cursors_edit()::malloc()");
+	}
+	memcpy(all, buf->cursors, sizeof(struct EditorCursor) * lo);
+	all[lo] = own;
+	memcpy(&all[lo + 1], &buf->cursors[lo], sizeof(struct EditorCursor) * (n - 1 - lo));
+
+	for (int i = 0; i < n;) {
+		int y = all[i].y;
+		int end = i;
+		while (end < n && all[end].y == y) {
+			end++;
+		}
+
+		if (y >= buf->numRows) {
+			i = end;
+			continue;
+		}
+
+		editor_cold_thaw(buf, y, y + 1);
+		struct EditorRow* row = &buf->row[y];
+
+		// Sizes the new chars and finds the bytes [first, last) of the row that change
+		int first = -1;
+		int last = 0;
+		int size = row->size;
+		for (int k = i; k < end; k++) {
+			int x = all[k].x < row->size ? all[k].x : row->size;
+			int from, to;
+			editor_cursors_span(row, x, key, &from, &to);
+
+			if (from == to && !insert) {
+				continue;
+			}
+
+			if (first == -1) {
+				first = from;
+			}
+			last = to;
+			size += insert - (to - from);
+		}
+
+		if (first == -1) {
+			i = end;
+			continue;
+		}
+
+		char* chars = malloc(size + 1);
+		if (chars == NULL) {
+			die("editor_cursors_edit()::malloc()");
+		}
+
+		// The cursors are distinct and sorted, so the spans follow each other without overlapping
+		int len = 0;
+		int prev = 0;
+		for (int k = i; k < end; k++) {
+			int x = all[k].x < row->size ? all[k].x : row->size;
+			int from, to;
+			editor_cursors_span(row, x, key, &from, &to);
+
+			memcpy(&chars[len], &row->chars[prev], from - prev);
+			len += from - prev;
+			if (insert) {
+				chars[len++] = ch;
+			}
+
+			all[k].x = len;
+			prev = to;
+		}
+		memcpy(&chars[len], &row->chars[prev], row->size - prev);
+		chars[size] = '\0';
+
+		editor_journal_splice(row, first, last - first, &chars[first], size - (row->size - last) - first);
+
+		free(row->chars);
+		row->chars = chars;
+		row->size = size;
+		editor_update_row(row);
+		buf->modified++;
+
+		// Counted right away, a dirty range from the first cursor to the last would be counted as a whole
+		editor_stats_sync(buf);
+
+		i = end;
+	}
+
+	// The spans of a row may have brought cursors together, they still are in order
+	buf->curx = all[lo].x;
+	buf->cury = all[lo].y;
+	memcpy(buf->cursors, all, sizeof(struct EditorCursor) * lo);
+	memcpy(&buf->cursors[lo], &all[lo + 1], sizeof(struct EditorCursor) * (n - 1 - lo));
+	editor_cursors_tidy(buf, 0);
+
+	free(all);
+}
+
+// Moves the cursor of the active buffer like the key does when there is only one
+void editor_cursors_move_one(int key) {
+	struct EditorBuffer* buf = ec.buf;
+
+	if (key == HOME) {
+		buf->curx = 0;
+	} else if (key == END) {
+		buf->curx = buf->cury < buf->numRows ? editor_buffer_row(buf, buf->cury)->size : 0;
+	} else {
+		editor_move_cursor(key);
+	}
+}
+
+void editor_cursors_move(int key) {
+	struct EditorBuffer* buf = ec.buf;
+	int curx = buf->curx;
+	int cury = buf->cury;
+
+	// Each extra cursor in turn is made the cursor of the buffer to reuse its moves
+	for (int i = 0; i < buf->numCursors; i++) {
+		buf->curx = buf->cursors[i].x;
+		buf->cury = buf->cursors[i].y;
+		editor_cursors_move_one(key);
+		buf->cursors[i].x = buf->curx;
+		buf->cursors[i].y = buf->cury;
+	}
+
+	buf->curx = curx;
+	buf->cury = cury;
+	editor_cursors_move_one(key);
+
+	// Cursors stopped by the first row or column can pass others, so they are sorted again
+	editor_cursors_tidy(buf, 1);
+}
+
+// Handles key when the active buffer has extra cursors, returns 0 when it is left to editor_process_keypress()
+int editor_cursors_key(int key) {
+	switch (key) {
+		case BACKSPACE:
+		case CTRL_KEY('h'):
+		case DEL:
+			if (!editor_read_only()) {
+				editor_cursors_edit(key);
+			}
+			return 1;
+
+		case ARROW_LEFT:
+		case ARROW_RIGHT:
+		case ARROW_UP:
+		case ARROW_DOWN:
+		case HOME:
+		case END:
+			editor_cursors_move(key);
+			return 1;
+	}
+
+	if (editor_is_text_key(key)) {
+		if (!editor_read_only()) {
+			editor_cursors_edit(key);
+		}
+		return 1;
+	}
+
+	editor_cursors_clear(ec.buf);
+	return 0;
+}
+
+/* Loads filename, adds a cursor at each match of find, 1 in 100 lines of the bench file, then types
+ * characters and Backspaces at all of them and prints how long each step took
+ */
+int editor_bench_cursors(char* filename, char* find) {
+	if (editor_open(filename) == -1) {
+		perror(filename);
+		return 1;
+	}
+	if (ec.buf->view) {
+		fprintf(stderr, "%s: too big to be held in memory\n", filename);
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int found = editor_cursors_add_matches(ec.buf, find, strlen(find));
+	printf("%d cursors added in %.1f ms\n", found, editor_bench_ms(&start));
+
+	if (found == 0) {
+		return 0;
+	}
+
+	// The first match becomes the cursor of the buffer
+	ec.buf->curx = ec.buf->cursors[0].x;
+	ec.buf->cury = ec.buf->cursors[0].y;
+	editor_cursors_tidy(ec.buf, 0);
+	editor_stats_sync(ec.buf); // Done by the first status bar drawn otherwise
+
+	int keys = 100;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < keys / 2; i++) {
+		editor_cursors_edit('x');
+	}
+	for (int i = 0; i < keys / 2; i++) {
+		editor_cursors_edit(BACKSPACE);
+	}
+	double ms = editor_bench_ms(&start);
+
+	printf("%d keys typed at %d cursors: %.3f ms per key\n", keys, ec.buf->numCursors + 1, ms / keys);
+
+	editor_journal_discard_all();
+
+	return 0;
+}
+
+/***** MACROS *****/
+
+/* Ctrl-k starts recording the keys editor_process_keypress() and the prompts read, Ctrl-k again stops.
+ * Ctrl-e replays them as many times as asked without drawing the screen in between, runs of characters
+ * typed one after another going into their row with a single editor_insert_string()
+ */
+
+void editor_macro_toggle(void) {
+	if (ec.recording) {
+		ec.recording = 0;
+
+		editor_set_status_message("Macro of %d keys recorded (Ctrl-e to replay)", ec.macroLen);
+		return;
+	}
+
+	ec.recording = 1;
+	ec.macroLen = 0;
+	editor_set_status_message("Recording a macro (Ctrl-k to stop)");
+}
+
+// Replays the recorded macro times times in a row
+void editor_macro_replay(int times) {
+	// run[j] is the number of characters to insert from key j on, text holds them as bytes
+	int* run = malloc(sizeof(int) * (ec.macroLen + 1));
+	char* text = malloc(ec.macroLen + 1);
+	if (run == NULL || text == NULL) {
+		die("editor_macro_replay()::malloc()");
+	}
+
+	run[ec.macroLen] = 0;
+	for (int j = ec.macroLen - 1; j >= 0; j--) {
+		int isText = editor_is_text_key(ec.macro[j]);
+		run[j] = isText ? run[j + 1] + 1 : 0;
+		text[j] = isText ? ec.macro[j] : 0;
+	}
+
+	ec.replaying = 1;
+
+	for (int i = 0; i < times; i++) {
+		ec.macroPos = 0;
+
+		while (ec.macroPos < ec.macroLen) {
+			int n = run[ec.macroPos];
+
+			if (n && editor_type_string(&text[ec.macroPos], n)) {
+				ec.macroPos += n;
+			} else {
+				editor_process_keypress();
+			}
+		}
+	}
+
+	ec.replaying = 0;
+
+	free(run);
+	free(text);
+}
+
+// Replays the recorded macro the number of times typed at the prompt, once for an empty input
+void editor_macro_replay_prompt(void) {
+	if (ec.recording) {
+		editor_set_status_message("Can't replay while recording (Ctrl-k to stop)");
+		return;
+	}
+
+	if (ec.macroLen == 0) {
+		editor_set_status_message("No macro recorded (Ctrl-k to start)");
+		return;
+	}
+
+	char* input = editor_prompt_input("Replay the macro how many times: %s (ESC to cancel)", NULL, 1);
+	if (input == NULL) {
+		return;
+	}
+
+	int times = input[0] ? atoi(input) : 1;
+	free(input);
+
+	if (times <= 0) {
+		editor_set_status_message("Not a number of times");
+		return;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	editor_macro_replay(times);
+
+	editor_set_status_message("Macro of %d keys replayed %d times in %.1f ms", ec.macroLen, times, editor_bench_ms(&start));
+}
+
+/* Loads filename, then replays a macro of 20 keys typing a line at the end of the file 100000 times
+ * and prints how long it took
+ */
+int editor_bench_macro(char* filename) {
+	if (editor_open(filename) == -1) {
+		perror(filename);
+		return 1;
+	}
+	if (ec.buf->view) {
+		fprintf(stderr, "%s: too big to be held in memory\n", filename);
+		return 1;
+	}
+
+	char* keys = "the quick brown fox\r";
+	ec.macroLen = strlen(keys);
+	ec.macro = malloc(sizeof(int) * ec.macroLen);
+	if (ec.macro == NULL) {
+		die("editor_bench_macro()::malloc()");
+	}
+	for (int j = 0; j < ec.macroLen; j++) {
+		ec.macro[j] = keys[j];
+	}
+
+	ec.buf->cury = ec.buf->numRows;
+	ec.buf->curx = 0;
+
+	int times = 100000;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	editor_macro_replay(times);
+	double ms = editor_bench_ms(&start);
+
+	printf("macro of %d keys replayed %d times in %.1f ms, %d rows now\n", ec.macroLen, times, ms, ec.buf->numRows);
+
+	editor_journal_discard_all();
+
+	return 0;
+}
+
+/***** FILTER *****/
+
+/* Ctrl-b sends the selected rows, or every row, to the stdin of a shell command like vi's !, and its
+ * output replaces them. The rows are written straight from the row array with writev() and the output
+ * is cut into new rows as it is read, so the buffer is never copied into one string. The pipes are fed
+ * while keys are awaited, the buffer can't be edited until the command is done or stopped by Ctrl-b
+ */
+
+// Starts command with rows from to to - 1 of buf going to its stdin, returns -1 with errno set if it can't
+int editor_filter_start(struct EditorBuffer* buf, int from, int to, char* command) {
+	int toChild[2];
+	int fromChild[2];
+
+	if (pipe2(toChild, O_CLOEXEC) == -1) {
+		return -1;
+	}
+	if (pipe2(fromChild, O_CLOEXEC) == -1) {
+		close(toChild[0]);
+		close(toChild[1]);
+		return -1;
+	}
+
+	// A command quitting before it read every row makes writev() fail with EPIPE instead of killing the editor
+	signal(SIGPIPE, SIG_IGN);
+
+	pid_t pid = fork();
+	if (pid == -1) {
+		close(toChild[0]);
+		close(toChild[1]);
+		close(fromChild[0]);
+		close(fromChild[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		signal(SIGPIPE, SIG_DFL);
+
+		// The messages of the command would be drawn over the editor
+		int devNull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		if (devNull != -1) {
+			dup2(devNull, STDERR_FILENO);
+		}
+
+		dup2(toChild[0], STDIN_FILENO);
+		dup2(fromChild[1], STDOUT_FILENO);
+		execl("/bin/sh", "sh", "-c", command, (char*) NULL);
+		_exit(127);
+	}
+
+	close(toChild[0]);
+	close(fromChild[1]);
+
+	struct FilterJob* job = calloc(1, sizeof(struct FilterJob));
+	if (job == NULL) {
+		die("editor_filter_start()::calloc()");
+	}
+
+	job->pid = pid;
+	job->in = toChild[1];
+	job->out = fromChild[0];
+	job->command = strdup(command);
+	job->from = from;
+	job->to = to;
+	job->next = from;
+	job->reader.buf = buf;
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+	// Bigger pipes mean fewer trips through poll() for big ranges, the default size does too
+	fcntl(job->in, F_SETPIPE_SZ, EDITOR_FILTER_PIPE);
+	fcntl(job->out, F_SETPIPE_SZ, EDITOR_FILTER_PIPE);
+	fcntl(job->in, F_SETFL, O_NONBLOCK);
+	fcntl(job->out, F_SETFL, O_NONBLOCK);
+
+	if (from == to) {
+		close(job->in);
+		job->in = -1;
+	}
+
+	buf->filter = job;
+
+	return 0;
+}
+
+// Writes as many of the rows left to send as the pipe of the filter of buf takes, each one followed by a newline
+void editor_filter_send(struct EditorBuffer* buf) {
+	struct FilterJob* job = buf->filter;
+	struct iovec iov[EDITOR_FILTER_IOV * 2];
+	int n = 0;
+
+	for (int j = job->next; j < job->to && n < EDITOR_FILTER_IOV * 2; j++) {
+		// The chars of the rows of only one packed block can be held at a time
+		struct ColdReader* r = &job->reader;
+		if (n > 0 && buf->row[j].chars == NULL && (j < r->first || j >= r->first + r->count)) {
+			break;
+		}
+
+		char* chars = editor_cold_peek(r, j);
+		int size = buf->row[j].size;
+		int skip = j == job->next ? job->sent : 0;
+
+		if (skip < size) {
+			iov[n].iov_base = &chars[skip];
+			iov[n].iov_len = size - skip;
+			n++;
+		}
+
+		iov[n].iov_base = "\n";
+		iov[n].iov_len = 1;
+		n++;
+	}
+
+	ssize_t written = writev(job->in, iov, n);
+	if (written == -1) {
+		if (errno == EAGAIN || errno == EINTR) {
+			return;
+		}
+
+		// The command stopped reading, what it didn't read is left out
+		written = 0;
+		job->next = job->to;
+	}
+
+	while (written > 0) {
+		long left = buf->row[job->next].size + 1 - job->sent;
+
+		if (written >= left) {
+			written -= left;
+			job->next++;
+			job->sent = 0;
+		} else {
+			job->sent += written;
+			written = 0;
+		}
+	}
+
+	if (job->next == job->to) {
+		close(job->in);
+		job->in = -1;
+	}
+}
+
+// Appends a row holding the len bytes of s to the output of job
+void editor_filter_add_row(struct FilterJob* job, char* s, size_t len) {
+	if (job->numRows == job->capRows) {
+		job->capRows = job->capRows ? job->capRows * 2 : 1024;
+		job->rows = realloc(job->rows, sizeof(struct EditorRow) * job->capRows);
+		if (job->rows == NULL) {
+			die("editor_filter_add_row()::realloc()");
+		}
+	}
+
+	editor_row_init(&job->rows[job->numRows++], s, len);
+}
+
+// Keeps the len bytes of s following the last newline of the output of job
+void editor_filter_keep(struct FilterJob* job, char* s, size_t len) {
+	if (len == 0) {
+		return;
+	}
+
+	if (job->partialLen + len > job->partialCap) {
+		job->partialCap = (job->partialLen + len) * 2;
+		job->partial = realloc(job->partial, job->partialCap);
+		if (job->partial == NULL) {
+			die("editor_filter_keep()::realloc()");
+		}
+	}
+
+	memcpy(&job->partial[job->partialLen], s, len);
+	job->partialLen += len;
+}
+
+// Reads what the command of job wrote and cuts it into rows, the bytes past the last newline wait for the next read
+void editor_filter_receive(struct FilterJob* job) {
+	static char chunk[EDITOR_FILTER_PIPE];
+
+	ssize_t nRead = read(job->out, chunk, sizeof chunk);
+	if (nRead == -1 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+
+	if (nRead <= 0) {
+		close(job->out);
+		job->out = -1;
+
+		// The last line may have no newline
+		if (job->partialLen) {
+			editor_filter_add_row(job, job->partial, job->partialLen);
+			job->partialLen = 0;
+		}
+		return;
+	}
+
+	char* p = chunk;
+	char* end = chunk + nRead;
+	char* nl;
+
+	while ((nl = memchr(p, '\n', end - p)) != NULL) {
+		if (job->partialLen) {
+			editor_filter_keep(job, p, nl - p);
+			editor_filter_add_row(job, job->partial, job->partialLen);
+			job->partialLen = 0;
+		} else {
+			editor_filter_add_row(job, p, nl - p);
+		}
+
+		p = nl + 1;
+	}
+
+	editor_filter_keep(job, p, end - p);
+}
+
+// Frees the filter of buf along with the output rows it still holds
+void editor_filter_free(struct EditorBuffer* buf) {
+	struct FilterJob* job = buf->filter;
+
+	for (int j = 0; j < job->numRows; j++) {
+		free(job->rows[j].chars);
+	}
+
+	free(job->rows);
+	free(job->reader.raw);
+	free(job->partial);
+	free(job->command);
+	free(job);
+	buf->filter = NULL;
+}
+
+// Replaces the rows sent through the filter of buf by its output if the command succeeded
+void editor_filter_finish(struct EditorBuffer* buf, int status) {
+	struct FilterJob* job = buf->filter;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		if (WIFEXITED(status)) {
+			editor_set_status_message("%s: exit status %d, rows left unchanged", job->command, WEXITSTATUS(status));
+		} else {
+			editor_set_status_message("%s: killed, rows left unchanged", job->command);
+		}
+
+		editor_filter_free(buf);
+		return;
+	}
+
+	int removed = job->to - job->from;
+	editor_remove_rows(buf, job->from, removed, NULL);
+	editor_insert_rows(buf, job->from, job->rows, job->numRows);
+
+	if (buf->cury >= job->to) {
+		buf->cury += job->numRows - removed;
+	} else if (buf->cury >= job->from) {
+		buf->cury = job->from;
+		buf->curx = 0;
+	}
+	buf->select = SELECT_NONE;
+	editor_cursors_clear(buf);
+
+	editor_set_status_message("%d rows filtered through %s into %d in %.1f ms", removed, job->command, job->numRows, editor_bench_ms(&job->start));
+
+	job->numRows = 0; // The buffer owns their chars now
+	editor_filter_free(buf);
+}
+
+// Kills the command of the filter of buf and leaves its rows as they are
+void editor_filter_stop(struct EditorBuffer* buf) {
+	struct FilterJob* job = buf->filter;
 
-	for (int j = 0; j < ec.numRows; j++) {
-		memcpy(p, ec.row[j].chars, ec.row[j].size);
-		p += ec.row[j].size;
-		*p = '\n';
-		p++;
+	kill(job->pid, SIGKILL);
+	if (job->in != -1) {
+		close(job->in);
 	}
+	if (job->out != -1) {
+		close(job->out);
+	}
+	waitpid(job->pid, NULL, 0);
 
-	return buf;
+	editor_set_status_message("%s stopped, rows left unchanged", job->command);
+	editor_filter_free(buf);
 }
 
-void editor_open(char* filename) {
-	free(ec.filename);
-	ec.filename = strdup(filename);
+/* Moves the running filter along until a key comes or EDITOR_FILTER_SLICE ms passed
+ * Returns 1 when it is done, the screen is drawn again then
+ */
+int editor_filter_tick(void) {
+	struct EditorBuffer* buf = NULL;
+	for (int i = 0; i < ec.numBufs; i++) {
+		if (ec.bufs[i]->filter) {
+			buf = ec.bufs[i];
+		}
+	}
 
-	FILE* fp = fopen(filename, "r");
-	if (!fp) {
-		die("editor_open()::fopen()");
+	if (buf == NULL) {
+		return 0;
 	}
 
-	char* line = NULL;
-	size_t lineCap = 0;
-	ssize_t lineLen;
+	struct FilterJob* job = buf->filter;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	while ((lineLen = getline(&line, &lineCap, fp)) != -1) {
-		while (lineLen > 0 && (line[lineLen - 1] == '\n' || line[lineLen - 1] == '\r')) {
-			lineLen--;
+	// poll() skips the pipes already closed, their fd is -1
+	while (job->in != -1 || job->out != -1) {
+		int left = EDITOR_FILTER_SLICE - (int) editor_bench_ms(&start);
+		if (left <= 0) {
+			return 0;
 		}
 
-		editor_insert_row(ec.numRows, line, lineLen);
-	}
+		struct pollfd fds[3] = {
+			{STDIN_FILENO, POLLIN, 0},
+			{job->in, POLLOUT, 0},
+			{job->out, POLLIN, 0}
+		};
 
-	free(line);
-	fclose(fp);
-	ec.modified = 0;
-}
+		if (poll(fds, 3, left) == -1) {
+			return 0;
+		}
 
-void editor_save(void) {
-	if (ec.filename == NULL) {
-		ec.filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
-		if (ec.filename == NULL) {
-			editor_set_status_message("Save aborted");
-			return;
+		if (fds[0].revents) {
+			return 0;
 		}
-	}
 
-	int len;
-	char* buf = editor_rows_to_string(&len);
-
-	int fd = open(ec.filename, O_RDWR | O_CREAT, 0644);
-	if (fd != 1) {
-		if (ftruncate(fd, len) != -1) {
-			if (write(fd, buf, len) == len) {
-				close(fd);
-				free(buf);
-				ec.modified = 0;
-				editor_set_status_message("%s: %d bytes written to disk", ec.filename, len);
-				return;
-			}
+		if (fds[1].revents) {
+			editor_filter_send(buf);
 		}
 
-		close(fd);
+		if (fds[2].revents) {
+			editor_filter_receive(job);
+		}
 	}
 
-	free(buf);
-	editor_set_status_message("%s: save failed! I/O error: %s", strerror(errno));
-}
+	// The output is closed, the command is waited for without blocking
+	int status;
+	pid_t pid = waitpid(job->pid, &status, WNOHANG);
+	if (pid == 0) {
+		return 0;
+	}
 
-/***** FIND *****/
+	editor_filter_finish(buf, pid == -1 ? -1 : status);
 
-void editor_find_callback(char* query, int key) {
-	/* lastMatch will store the index of the last match is such match existed, or -1 if no such match existed */
-	static int lastMatch = -1;
+	return 1;
+}
 
-	/* direction will store the value 1 if it's forward and -1 if it's backward */
-	static int direction = 1;
+// Asks for a command to filter the selected rows of the active buffer through, every row when none are selected
+void editor_filter_prompt(void) {
+	struct EditorBuffer* buf = ec.buf;
 
-	if (key == '\r' || key == '\x1b') {
-		/* Restore lastMatch and direction's initial value */
-		lastMatch = -1;
-		direction = 1;
+	if (buf->filter) {
+		editor_filter_stop(buf);
 		return;
-	} else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-		direction = 1;
-	} else if (key == ARROW_LEFT || key == ARROW_RIGHT) {
-		direction = -1;
-	} else {
-		lastMatch = -1;
-		direction = 1;
 	}
 
-	if (lastMatch == -1) {
-		direction = 1;
+	if (editor_read_only()) {
+		return;
 	}
 
-	int current = lastMatch;
-	for (int i = 0; i < ec.numRows; i++) {
-		current += direction;
+	if (buf->follow) {
+		editor_set_status_message("Rows can't be filtered while the file is followed (Ctrl-t to stop)");
+		return;
+	}
 
-		/* Search wrapping logic */
-		if (current == -1) {
-			current = ec.numRows - 1;
-		} else if (current == ec.numRows) {
-			current = 0;
+	for (int i = 0; i < ec.numBufs; i++) {
+		if (ec.bufs[i]->filter) {
+			editor_set_status_message("Buffer %d is being filtered already", i + 1);
+			return;
 		}
+	}
 
-		struct EditorRow* row = &ec.row[current];
-		char* match = strstr(row->render, query);
-		if (match) {
-			lastMatch = current;
-			ec.cury = current;
-			ec.curx = editor_row_rx_to_curx(row, match - row->render);
-			ec.rowOffset = ec.numRows;
-			break;
-		}
+	int from = 0;
+	int to = buf->numRows;
+
+	if (buf->select != SELECT_NONE && buf->numRows > 0) {
+		int x0, y0, x1, y1;
+		editor_selection_bounds(buf, &x0, &y0, &x1, &y1);
+
+		from = y0 < buf->numRows ? y0 : buf->numRows - 1;
+		to = y1 < buf->numRows ? y1 + 1 : buf->numRows;
 	}
-}
 
-void editor_find(void) {
-	int savedCurx = ec.curx;
-	int savedCury = ec.cury;
-	int savedColOffset = ec.colOffset;
-	int savedRowOffset = ec.rowOffset;
+	char prompt[80];
+	snprintf(prompt, sizeof prompt, "Filter %d rows through: %%s (ESC to cancel)", to - from);
 
-	char* query = editor_prompt("Search: %s (Use ESC/Arrows/Enter)", editor_find_callback);
+	char* command = editor_prompt(prompt, NULL);
+	if (command == NULL) {
+		return;
+	}
 
-	if (query) {
-		free(query);
+	if (editor_filter_start(buf, from, to, command) == -1) {
+		editor_set_status_message("%s: can't run: %s", command, strerror(errno));
 	} else {
-		ec.curx = savedCurx;
-		ec.cury = savedCury;
-		ec.colOffset = savedColOffset;
-		ec.rowOffset = savedRowOffset;
+		editor_set_status_message("Filtering %d rows through %s (Ctrl-b to stop)", to - from, command);
 	}
+
+	free(command);
 }
 
 /***** APPEND BUFFER *****/
@@ -636,36 +6955,113 @@ void ab_free(struct AppendBuffer* ab) {
 
 /***** OUTPUT *****/
 
-void editor_scroll(void) {
-	ec.rx = 0;
+// Returns the number of columns left for the text of buf, the diff gutter takes the first ones
+int editor_text_cols(struct EditorBuffer* buf) {
+	return buf->diff ? ec.screenCols - EDITOR_DIFF_GUTTER : ec.screenCols;
+}
+
+void editor_scroll(struct EditorWindow* win) {
+	struct EditorBuffer* buf = win->buf;
+
+	buf->rx = 0;
+
+	if (buf->cury < buf->numRows) {
+		buf->rx = editor_row_curx_to_rx(editor_buffer_row(buf, buf->cury), buf->curx);
+	}
+
+	if (buf->cury < buf->rowOffset) {
+		buf->rowOffset = buf->cury;
+	}
+
+	if (buf->cury >= buf->rowOffset + win->rows) {
+		buf->rowOffset = buf->cury - win->rows + 1;
+	}
 
-	if (ec.cury < ec.numRows) {
-		ec.rx = editor_row_curx_to_rx(&ec.row[ec.cury], ec.curx);
+	if (buf->rx < buf->colOffset) {
+		buf->colOffset = buf->rx;
 	}
 
-	if (ec.cury < ec.rowOffset) {
-		ec.rowOffset = ec.cury;
+	if (buf->rx >= buf->colOffset + editor_text_cols(buf)) {
+		buf->colOffset = buf->rx - editor_text_cols(buf) + 1;
 	}
+}
+
+int editor_clamp(int v, int lo, int hi) {
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* Appends the cols columns of a row with non-ASCII bytes that are visible from column colOffset
+ * Wide characters cut by the left or right edge are shown as spaces, columns in [selStart, selEnd) in reverse video
+ */
+void editor_draw_row_utf8(struct AppendBuffer* ab, struct EditorRow* row, int colOffset, int cols, int selStart, int selEnd) {
+	int col = 0;
+	int j = 0;
+	int right = colOffset + cols;
+	int reverse = 0;
+
+	while (j < row->rsize && col < right) {
+		int cp;
+		int n = utf8_decode(&row->render[j], row->rsize - j, &cp);
+		int w = utf8_width(cp);
+
+		int selected = col >= selStart && col < selEnd;
+		if (selected != reverse && col >= colOffset) {
+			ab_append(ab, selected ? "\x1b[7m" : "\x1b[m", selected ? 4 : 3);
+			reverse = selected;
+		}
+
+		if (col >= colOffset && col + w <= right) {
+			ab_append(ab, &row->render[j], n);
+		} else if (col + w > colOffset) {
+			for (int k = col < colOffset ? colOffset : col; k < col + w && k < right; k++) {
+				ab_append(ab, " ", 1);
+			}
+		}
 
-	if (ec.cury >= ec.rowOffset + ec.screenRows) {
-		ec.rowOffset = ec.cury - ec.screenRows + 1;
+		col += w;
+		j += n;
 	}
 
-	if (ec.rx < ec.colOffset) {
-		ec.colOffset = ec.rx;
+	if (reverse) {
+		ab_append(ab, "\x1b[m", 3);
 	}
+}
 
-	if (ec.rx >= ec.colOffset + ec.screenCols) {
-		ec.colOffset = ec.rx - ec.screenCols + 1;
+// Appends the diff mark of row at of buf, at == numRows for lines removed at the end
+void editor_draw_diff_mark(struct AppendBuffer* ab, struct EditorBuffer* buf, int at) {
+	char mark = at <= buf->numRows ? buf->diff->mark[at] : DIFF_SAME;
+
+	switch (mark) {
+		case DIFF_ADDED:
+			ab_append(ab, "\x1b[32m+\x1b[m ", 10);
+			break;
+		case DIFF_CHANGED:
+			ab_append(ab, "\x1b[33m~\x1b[m ", 10);
+			break;
+		case DIFF_REMOVED:
+			ab_append(ab, "\x1b[31m-\x1b[m ", 10);
+			break;
+		default:
+			ab_append(ab, "  ", EDITOR_DIFF_GUTTER);
 	}
 }
 
-// Draws the tildes marking the lines / rows
-void editor_draw_rows(struct AppendBuffer* ab) {
-	for (int y = 0; y < ec.screenRows; y++) {
-		int fileRow = y + ec.rowOffset;
-		if (fileRow >= ec.numRows) {
-			if (ec.numRows == 0 && y == ec.screenRows / 3) {
+// Draws the tildes marking the lines / rows of a window
+void editor_draw_rows(struct AppendBuffer* ab, struct EditorWindow* win) {
+	struct EditorBuffer* buf = win->buf;
+	int cols = editor_text_cols(buf);
+
+	buf->share->lastViewed = time(NULL);
+	buf->share->rendersDropped = 0;
+
+	for (int y = 0; y < win->rows; y++) {
+		int fileRow = y + buf->rowOffset;
+
+		if (buf->diff) {
+			editor_draw_diff_mark(ab, buf, fileRow);
+		}
+		if (fileRow >= buf->numRows) {
+			if (buf->numRows == 0 && y == win->rows / 3) {
 				char welcome[80];
 
 				int welcomeLen = snprintf(welcome, sizeof welcome, "%s -- version %s", EDITOR_NAME, EDITOR_VERSION);
@@ -681,7 +7077,7 @@ void editor_draw_rows(struct AppendBuffer* ab) {
 				while (wpadding--) ab_append(ab, " ", 1);
 
 				ab_append(ab, welcome, welcomeLen); // Appends the welcome message
-			} else if (ec.numRows == 0 && y == (ec.screenRows / 3) + 2) {
+			} else if (buf->numRows == 0 && y == (win->rows / 3) + 2) {
 				char author[80];
 
 				int authorLen = snprintf(author, sizeof author, "Made by %s", EDITOR_AUTHOR);
@@ -701,17 +7097,37 @@ void editor_draw_rows(struct AppendBuffer* ab) {
 				ab_append(ab, "~", 1); // Append a tilde to buffer
 			}
 		} else {
-			int len = ec.row[fileRow].rsize - ec.colOffset;
+			struct EditorRow* row = editor_buffer_row(buf, fileRow);
+			char* render = editor_row_render(row);
 
-			if (len < 0) {
-				len = 0;
-			}
+			int selStart, selEnd;
+			editor_selection_cols(buf, fileRow, row, &selStart, &selEnd);
 
-			if (len > ec.screenCols) {
-				len = ec.screenCols;
-			}
+			if (row->cols) {
+				editor_draw_row_utf8(ab, row, buf->colOffset, cols, selStart, selEnd);
+			} else {
+				int len = row->rsize - buf->colOffset;
+
+				if (len < 0) {
+					len = 0;
+				}
 
-			ab_append(ab, &ec.row[fileRow].render[ec.colOffset], len);
+				if (len > cols) {
+					len = cols;
+				}
+
+				// Selected columns are drawn in reverse video
+				int from = editor_clamp(selStart - buf->colOffset, 0, len);
+				int to = editor_clamp(selEnd - buf->colOffset, from, len);
+
+				ab_append(ab, &render[buf->colOffset], from);
+				if (to > from) {
+					ab_append(ab, "\x1b[7m", 4);
+					ab_append(ab, &render[buf->colOffset + from], to - from);
+					ab_append(ab, "\x1b[m", 3);
+				}
+				ab_append(ab, &render[buf->colOffset + to], len - to);
+			}
 		}
 
 		ab_append(ab, "\x1b[K", 3); // Clears things to the right of cursor in current line
@@ -719,16 +7135,81 @@ void editor_draw_rows(struct AppendBuffer* ab) {
 	}
 }
 
-void editor_draw_status_bar(struct AppendBuffer* ab) {
+// Draws the extra cursors of the buffer of a window that are visible, in reverse video
+void editor_draw_cursors(struct AppendBuffer* ab, struct EditorWindow* win) {
+	struct EditorBuffer* buf = win->buf;
+	int cols = editor_text_cols(buf);
+
+	// Only the cursors on the rows shown are looked at, the first one is found by bisection
+	int lo = 0;
+	int hi = buf->numCursors;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (buf->cursors[mid].y < buf->rowOffset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (int i = lo; i < buf->numCursors && buf->cursors[i].y < buf->rowOffset + win->rows; i++) {
+		struct EditorCursor* c = &buf->cursors[i];
+		struct EditorRow* row = c->y < buf->numRows ? editor_buffer_row(buf, c->y) : NULL;
+		int rx = row ? editor_row_curx_to_rx(row, c->x) : 0;
+
+		if (rx < buf->colOffset || rx >= buf->colOffset + cols) {
+			continue;
+		}
+
+		// The character under the cursor is shown, a space for the end of the row, tabs and wide cut ones
+		char* glyph = " ";
+		int len = 1;
+		if (row && c->x < row->size) {
+			int cp;
+			int n = utf8_decode(&row->chars[c->x], row->size - c->x, &cp);
+			if (cp > ' ' && cp != 0x7F && rx + utf8_width(cp) <= buf->colOffset + cols) {
+				glyph = &row->chars[c->x];
+				len = n;
+			}
+		}
+
+		char pos[32];
+		snprintf(pos, sizeof pos, "\x1b[%d;%dH\x1b[7m", win->top + (c->y - buf->rowOffset) + 1, (rx - buf->colOffset) + 1 + ec.screenCols - cols);
+		ab_append(ab, pos, strlen(pos));
+		ab_append(ab, glyph, len);
+		ab_append(ab, "\x1b[m", 3);
+	}
+}
+
+void editor_draw_status_bar(struct AppendBuffer* ab, struct EditorWindow* win) {
+	struct EditorBuffer* buf = win->buf;
+
 	ab_append(ab, "\x1b[7m", 4);
 
-	char status[80];
+	char status[160];
 	char rstatus[80];
+	char counts[80] = "";
+	char offset[32] = "";
+
+	// A view is never read as a whole, its counts are unknown
+	if (!buf->view) {
+		struct RowStats* st = &buf->share->stats;
+		long long at = editor_stats_offset(buf, buf->cury);
+		if (buf->cury < buf->numRows) {
+			at += buf->curx;
+		}
 
-	int len = snprintf(status, sizeof status, "%.20s - %d lines %s", ec.filename ? ec.filename : "[No Name]", ec.numRows, ec.modified ? "(modified)" : "");
-	int rlen = snprintf(rstatus, sizeof rstatus, "%d/%d", ec.cury + 1, ec.numRows);
+		snprintf(counts, sizeof counts, ", %lld words, %lld chars, %lld bytes", st->words, st->chars, st->bytes);
+		snprintf(offset, sizeof offset, " byte %lld", at);
+	}
+
+	int len = snprintf(status, sizeof status, "[%d] %.20s - %d lines%s %s %s", buf->id + 1, buf->filename ? buf->filename : "[No Name]", buf->numRows, counts, buf->view ? "(view)" : buf->modified ? "(modified)" : "", buf->select == SELECT_CHARS ? "-- SELECT --" : buf->select == SELECT_LINES ? "-- SELECT LINES --" : "");
+	int rlen = snprintf(rstatus, sizeof rstatus, "%s%d/%d%s", win == &ec.win[ec.curWin] ? "* " : "", buf->cury + 1, buf->numRows, offset);
 
-	if (len > ec.screenCols) {
+	// The counts make the left part long, it is cut to keep the cursor position in view
+	if (len > ec.screenCols - rlen && rlen < ec.screenCols) {
+		len = ec.screenCols - rlen;
+	} else if (len > ec.screenCols) {
 		len = ec.screenCols;
 	}
 	ab_append(ab, status, len);
@@ -762,7 +7243,14 @@ void editor_draw_message_bar(struct AppendBuffer* ab) {
 
 // Refreshes the terminal screen
 void editor_refresh_screen(void) {
-	editor_scroll();
+	// A macro is replayed headless, the screen is drawn once when it is done
+	if (ec.replaying) {
+		return;
+	}
+
+	for (int i = 0; i < ec.numWins; i++) {
+		editor_scroll(&ec.win[i]);
+	}
 
 	struct AppendBuffer ab = APPEND_BUFFER_INIT;
 
@@ -786,14 +7274,21 @@ void editor_refresh_screen(void) {
 	 */
 	ab_append(&ab, "\x1b[H", 3);
 
-	editor_draw_rows(&ab); // Draws the text editor rows
+	// Windows are stacked top to bottom, so drawing them in order fills the screen
+	for (int i = 0; i < ec.numWins; i++) {
+		editor_draw_rows(&ab, &ec.win[i]); // Draws the text editor rows
+
+		editor_draw_status_bar(&ab, &ec.win[i]); // Draws the window's status bar
+	}
 
-	editor_draw_status_bar(&ab); // Draws the text editor status bar
+	for (int i = 0; i < ec.numWins; i++) {
+		editor_draw_cursors(&ab, &ec.win[i]); // Draws the extra cursors over the rows
+	}
 
 	editor_draw_message_bar(&ab); // Draws the text editor status message
 
 	char buf[32];
-	snprintf(buf, sizeof buf, "\x1b[%d;%dH", (ec.cury - ec.rowOffset) + 1, (ec.rx - ec.colOffset) + 1);
+	snprintf(buf, sizeof buf, "\x1b[%d;%dH", ec.win[ec.curWin].top + (ec.buf->cury - ec.buf->rowOffset) + 1, (ec.buf->rx - ec.buf->colOffset) + 1 + ec.screenCols - editor_text_cols(ec.buf));
 	ab_append(&ab, buf, strlen(buf));
 
 	// Show the cursor again after done drawing
@@ -815,6 +7310,11 @@ void editor_set_status_message(const char* fmt, ...) {
 /***** INPUT *****/
 
 char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
+	return editor_prompt_input(prompt, callback, 0);
+}
+
+// Like editor_prompt(), but Enter is also accepted on an empty input when allowEmpty is set
+char* editor_prompt_input(char* prompt, void (*callback)(char*, int), int allowEmpty) {
 	size_t bufsize = 128;
 	char* buf = malloc(bufsize);
 
@@ -827,8 +7327,11 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
 
 		int c = editor_read_key();
 		if (c == DEL || c == CTRL_KEY('h') || c == BACKSPACE) {
+			// Steps back over a whole character, like Backspace in a row
 			if (buflen != 0) {
-				buf[--buflen] = '\0';
+				struct EditorRow input = {.size = buflen, .chars = buf};
+				buflen = editor_row_prev_char(&input, buflen);
+				buf[buflen] = '\0';
 			}
 		} else if (c == '\x1b') {
 			editor_set_status_message("");
@@ -839,7 +7342,7 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
 			free(buf);
 			return NULL;
 		} else if (c == '\r') {
-			if (buflen != 0) {
+			if (buflen != 0 || allowEmpty) {
 				editor_set_status_message("");
 				if (callback) {
 					callback(buf, c);
@@ -847,7 +7350,7 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
 
 				return buf;
 			}
-		} else if (!iscntrl(c) && c < 128) {
+		} else if (c < 256 && !iscntrl(c)) {
 			if (buflen == bufsize - 1) {
 				bufsize *= 2;
 				buf = realloc(buf, bufsize);
@@ -864,77 +7367,184 @@ char* editor_prompt(char* prompt, void (*callback)(char*, int)) {
 
 // Handles cursor movement
 void editor_move_cursor(int key) {
-	struct EditorRow* row = (ec.cury >= ec.numRows) ? NULL : &ec.row[ec.cury];
+	struct EditorRow* row = (ec.buf->cury >= ec.buf->numRows) ? NULL : editor_buffer_row(ec.buf, ec.buf->cury);
 
 	switch (key) {
 		case ARROW_LEFT:
-			if (ec.curx != 0) {
-				ec.curx--;
-			} else if (ec.cury > 0) {
-				ec.cury--;
-				ec.curx = ec.row[ec.cury].size;
+			if (ec.buf->curx != 0) {
+				ec.buf->curx = editor_row_prev_char(row, ec.buf->curx);
+			} else if (ec.buf->cury > 0) {
+				ec.buf->cury--;
+				ec.buf->curx = editor_buffer_row(ec.buf, ec.buf->cury)->size;
 			}
 			break;
 		case ARROW_RIGHT:
-			if (row && ec.curx < row->size) {
-				ec.curx++;
-			} else if (row && ec.curx == row->size) {
-				ec.cury++;
-				ec.curx = 0;
+			if (row && ec.buf->curx < row->size) {
+				ec.buf->curx = editor_row_next_char(row, ec.buf->curx);
+			} else if (row && ec.buf->curx == row->size) {
+				ec.buf->cury++;
+				ec.buf->curx = 0;
 			}
 			break;
 		case ARROW_UP:
-			if (ec.cury != 0) {
-				ec.cury--;
+			if (ec.buf->cury != 0) {
+				ec.buf->cury--;
 			}
 			break;
 		case ARROW_DOWN:
-			if (ec.cury < ec.numRows) {
-				ec.cury++;
+			if (ec.buf->cury < ec.buf->numRows) {
+				ec.buf->cury++;
 			}
 			break;
 	}
 
-	row = (ec.cury >= ec.numRows) ? NULL : &ec.row[ec.cury];
+	row = (ec.buf->cury >= ec.buf->numRows) ? NULL : editor_buffer_row(ec.buf, ec.buf->cury);
 	int rowLen = row ? row->size : 0;
-	if (ec.curx > rowLen) {
-		ec.curx = rowLen;
+	if (ec.buf->curx > rowLen) {
+		ec.buf->curx = rowLen;
+	}
+
+	if (row) {
+		ec.buf->curx = editor_row_char_start(row, ec.buf->curx);
+	}
+}
+
+// Opens a file typed at the prompt in a new buffer
+void editor_open_prompt(void) {
+	char* filename = editor_prompt("Open: %s (ESC to cancel)", NULL);
+	if (filename == NULL) {
+		return;
+	}
+
+	if (editor_open(filename) == -1) {
+		editor_set_status_message("%s: can't open: %s", filename, strerror(errno));
+	}
+
+	free(filename);
+}
+
+// Moves the cursor to a line typed at the prompt, in view mode only that line's window is read
+void editor_goto_line(void) {
+	char* input = editor_prompt("Go to line: %s (ESC to cancel)", NULL);
+	if (input == NULL) {
+		return;
+	}
+
+	int line = atoi(input);
+	free(input);
+
+	if (line < 1) {
+		line = 1;
 	}
+	if (line > ec.buf->numRows) {
+		line = ec.buf->numRows;
+	}
+
+	ec.buf->cury = line > 0 ? line - 1 : 0;
+	ec.buf->curx = 0;
+}
+
+// Handles the key following Ctrl-w, window and buffer commands like vi / vim
+void editor_window_command(void) {
+	editor_set_status_message("Ctrl-w: s = split | w = next window | c = close window | n/p = next/prev buffer");
+	editor_refresh_screen();
+
+	int c = editor_read_key();
+	editor_set_status_message("");
+
+	switch (c) {
+		case 's':
+			editor_split_window();
+			break;
+		case 'w':
+		case CTRL_KEY('w'):
+			editor_focus_window((ec.curWin + 1) % ec.numWins);
+			break;
+		case 'c':
+			editor_close_window();
+			break;
+		case 'n':
+			editor_next_buffer(1);
+			break;
+		case 'p':
+			editor_next_buffer(-1);
+			break;
+	}
+}
+
+// Returns the number of buffers holding unsaved changes
+int editor_modified_buffers(void) {
+	int count = 0;
+	for (int i = 0; i < ec.numBufs; i++) {
+		if (ec.bufs[i]->modified) {
+			count++;
+		}
+	}
+
+	return count;
 }
 
 // Handles keypress input
+static int quitTimes = EDITOR_QUIT_TIMES;
+
+/* Types the len bytes of s, keys editor_is_text_key() accepts, as if they reached the default case of
+ * editor_process_keypress() one by one but with one rebuild of the row
+ * Returns 0 without typing when extra cursors take the keys their own way
+ */
+int editor_type_string(char* s, int len) {
+	if (ec.buf->numCursors) {
+		return 0;
+	}
+
+	if (!editor_read_only()) {
+		editor_insert_string(s, len);
+	}
+
+	quitTimes = EDITOR_QUIT_TIMES;
+	return 1;
+}
+
 void editor_process_keypress(void) {
-	static int quitTimes = EDITOR_QUIT_TIMES;
 	int c = editor_read_key();
 
+	if (ec.buf->numCursors && editor_cursors_key(c)) {
+		return;
+	}
+
 	switch (c) {
 		case '\r':
-			editor_insert_newline();
+			if (!editor_read_only()) {
+				editor_insert_newline();
+			}
 			break;
 
 		// If input is Ctrl-q, exit the program with return value of 0 (success)
 		case CTRL_KEY('q'):
-			if (ec.modified && quitTimes > 0) {
-				editor_set_status_message("File has unsaved changes! Press Ctrl-q %d more times to quit.", quitTimes);
+			if (editor_modified_buffers() && quitTimes > 0) {
+				editor_set_status_message("%d buffer(s) have unsaved changes! Press Ctrl-q %d more times to quit.", editor_modified_buffers(), quitTimes);
 				quitTimes--;
 				return;
 			}
 
+			editor_journal_discard_all();
+
 			write(STDOUT_FILENO, "\x1b[2J", 4); // Clears the screen
 			write(STDOUT_FILENO, "\x1b[H", 3); // Reposition the cursor to row 1 collumn 1
 			exit(0);
 			break;
 
 		case CTRL_KEY('s'):
-			editor_save();
+			if (!editor_read_only()) {
+				editor_save();
+			}
 			break;
 
 		case HOME:
-			ec.curx = 0;
+			ec.buf->curx = 0;
 			break;
 		case END:
-			if (ec.cury < ec.numRows) {
-				ec.curx = ec.row[ec.cury].size;
+			if (ec.buf->cury < ec.buf->numRows) {
+				ec.buf->curx = editor_buffer_row(ec.buf, ec.buf->cury)->size;
 			}
 			break;
 
@@ -942,9 +7552,64 @@ void editor_process_keypress(void) {
 			editor_find();
 			break;
 
+		case CTRL_KEY('r'):
+			if (!editor_read_only()) {
+				editor_replace();
+			}
+			break;
+
+		case CTRL_KEY('o'):
+			editor_open_prompt();
+			break;
+
+		case CTRL_KEY('g'):
+			editor_goto_line();
+			break;
+
+		case CTRL_KEY('t'):
+			editor_follow_toggle();
+			break;
+
+		case CTRL_KEY('d'):
+			editor_diff_toggle();
+			break;
+
+		case CTRL_KEY('n'):
+		case CTRL_KEY('p'):
+			if (!editor_read_only()) {
+				editor_complete(c == CTRL_KEY('n') ? 1 : -1);
+			}
+			break;
+
+		case CTRL_KEY('a'):
+			if (!editor_read_only()) {
+				editor_cursors_add();
+			}
+			break;
+
+		case CTRL_KEY('w'):
+			editor_window_command();
+			break;
+
+		case CTRL_KEY('k'):
+			editor_macro_toggle();
+			break;
+
+		case CTRL_KEY('e'):
+			editor_macro_replay_prompt();
+			break;
+
+		case CTRL_KEY('b'):
+			editor_filter_prompt();
+			break;
+
 		case BACKSPACE:
 		case CTRL_KEY('h'):
 		case DEL:
+			if (editor_read_only()) {
+				break;
+			}
+
 			if (c == DEL) {
 				editor_move_cursor(ARROW_RIGHT);
 			}
@@ -955,17 +7620,19 @@ void editor_process_keypress(void) {
 		case PAGE_UP:
 		case PAGE_DOWN:
 			{
+				int rows = ec.win[ec.curWin].rows;
+
 				if (c == PAGE_UP) {
-					ec.cury = ec.rowOffset;
+					ec.buf->cury = ec.buf->rowOffset;
 				} else if (c == PAGE_DOWN) {
-					ec.cury = ec.rowOffset + ec.screenRows - 1;
+					ec.buf->cury = ec.buf->rowOffset + rows - 1;
 
-					if (ec.cury > ec.numRows) {
-						ec.cury = ec.numRows;
+					if (ec.buf->cury > ec.buf->numRows) {
+						ec.buf->cury = ec.buf->numRows;
 					}
 				}
 
-				int times = ec.screenRows;
+				int times = rows;
 				while (times--) {
 					editor_move_cursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
 				}
@@ -979,12 +7646,37 @@ void editor_process_keypress(void) {
 			editor_move_cursor(c);
 			break;
 
-		case CTRL_KEY('l'):
+		case CTRL_KEY('v'):
+			editor_toggle_selection();
+			break;
+
+		case CTRL_KEY('c'):
+			editor_copy();
+			break;
+
+		case CTRL_KEY('x'):
+			if (!editor_read_only()) {
+				editor_cut();
+			}
+			break;
+
+		case CTRL_KEY('y'):
+			if (!editor_read_only()) {
+				editor_paste();
+			}
+			break;
+
 		case '\x1b':
+			ec.buf->select = SELECT_NONE;
+			break;
+
+		case CTRL_KEY('l'):
 			break;
 
 		default:
-			editor_insert_char(c);
+			if (!editor_read_only()) {
+				editor_insert_char(c);
+			}
 			break;
 	}
 
@@ -995,43 +7687,88 @@ void editor_process_keypress(void) {
 
 // Acquire the terminal size
 void init_editor(void) {
-	// Initialize the cursor positions
-	ec.curx = 0;
-	ec.cury = 0;
-	ec.rx = 0;
-	ec.rowOffset = 0;
-	ec.colOffset = 0;
-	ec.numRows = 0;
-	ec.row = NULL;
-	ec.modified = 0;
-	ec.filename = NULL;
+	ec.numBufs = 0;
+	ec.bufs = NULL;
+	ec.buf = NULL;
+	ec.numWins = 1;
+	ec.curWin = 0;
+	ec.win[0].buf = NULL;
+	ec.inotifyFd = -1;
+	ec.coldBudget = EDITOR_COLD_BUDGET;
 	ec.statusmsg[0] = '\0';
 	ec.statusmsg_time = 0;
 
 	// Gets the terminal rows and collumn size
 	// If it fails, die() is called
-	if (get_window_size(&ec.screenRows, &ec.screenCols) == -1)
+	if (get_window_size(&ec.textRows, &ec.screenCols) == -1)
 		die("init_editor()::get_window_size()");
 
-	ec.screenRows -= 2;
+	ec.textRows -= 1; // Room for the message bar
+
+	editor_layout_windows();
 }
 
 // Program starts here
 int main(int argc, char* argv[argc + 1]) {
+	// Times cold and warm opens of a big file instead of editing it, see editor_bench_open()
+	if (argc == 3 && strcmp(argv[1], "--bench-open") == 0) {
+		return editor_bench_open(argv[2]);
+	}
+	if (argc == 3 && strcmp(argv[1], "--bench-cold") == 0) {
+		return editor_bench_cold(argv[2]);
+	}
+
+	if (argc == 3 && strcmp(argv[1], "--bench-complete") == 0) {
+		return editor_bench_complete(argv[2]);
+	}
+
+	if ((argc == 3 || argc == 4) && strcmp(argv[1], "--bench-cursors") == 0) {
+		return editor_bench_cursors(argv[2], argc == 4 ? argv[3] : "99 ");
+	}
+
+	if (argc == 3 && strcmp(argv[1], "--bench-macro") == 0) {
+		return editor_bench_macro(argv[2]);
+	}
+
 	enable_raw_mode(); // Enables raw mode in terminal
 
-	init_editor(); // Gets the terminal size (initializing the screenRows and screenCols fields in ec)
+	init_editor(); // Gets the terminal size (initializing the textRows and screenCols fields in ec)
 
-	if (argc >= 2) {
-		editor_open(argv[1]);
+	// Every file on the command line gets its own buffer, the first one is shown
+	// Files following -v are opened in view mode whatever their size
+	// -m <MiB> sets the memory kept for unpacked rows before cold ones are packed
+	int view = 0;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-v") == 0) {
+			view = 1;
+			continue;
+		}
+
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			ec.coldBudget = (size_t)atoll(argv[++i]) << 20;
+			continue;
+		}
+
+		if ((view ? editor_open_view(argv[i]) : editor_open(argv[i])) == -1) {
+			die("editor_open()::fopen()");
+		}
+	}
+
+	if (ec.numBufs == 0) {
+		editor_switch_buffer(editor_buffer_new(NULL));
+	} else {
+		editor_switch_buffer(ec.bufs[0]);
 	}
 
-	editor_set_status_message("Ctrl-s: save | Ctrl-q: quit | Ctrl-f = find");
+	// A message left while opening (like a recovery report) is kept
+	if (ec.statusmsg[0] == '\0')
+		editor_set_status_message("Ctrl-s: save | Ctrl-q: quit | Ctrl-f = find | Ctrl-o = open | Ctrl-g = go to line | Ctrl-w = windows");
 
 	/* Refreshes the screen and runs the input gathering and processing function */
 	while (1) {
 		editor_refresh_screen();
 		editor_process_keypress();
+		editor_drop_idle_renders();
 	}
 
 	return 0;